@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * Writes an uncompressed texture cache with COUNT 1x1 GR_RGBA8 textures to
+ * stdout. The records are as small as possible, so a run over it is
+ * dominated by the parsing of the file headers.
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_PAYLOAD_SIZE 4
+
+static void store_le16(uint8_t *buf, uint16_t value)
+{
+	buf[0] = (uint8_t)value;
+	buf[1] = (uint8_t)(value >> 8);
+}
+
+static void store_le32(uint8_t *buf, uint32_t value)
+{
+	store_le16(buf, (uint16_t)value);
+	store_le16(buf + 2, (uint16_t)(value >> 16));
+}
+
+static void store_le64(uint8_t *buf, uint64_t value)
+{
+	store_le32(buf, (uint32_t)value);
+	store_le32(buf + 4, (uint32_t)(value >> 32));
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t record[FILE_HEADER_SIZE + BENCH_PAYLOAD_SIZE];
+	uint8_t config[4];
+	unsigned long long count, i;
+	char *end;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s COUNT\n", argv[0]);
+		return 1;
+	}
+
+	errno = 0;
+	count = strtoull(argv[1], &end, 0);
+	if (errno || *end != '\0') {
+		fprintf(stderr, "Invalid number of records %s\n", argv[1]);
+		return 1;
+	}
+
+	store_le32(config, RICE_HIRESTEXTURES);
+	if (fwrite(config, sizeof(config), 1, stdout) != 1)
+		return 1;
+
+	memset(record, 0, sizeof(record));
+	store_le32(record + 8, 1);
+	store_le32(record + 12, 1);
+	store_le32(record + 16, GR_RGBA8);
+	record[24] = 1;
+	store_le32(record + 25, BENCH_PAYLOAD_SIZE);
+
+	for (i = 0; i < count; i++) {
+		store_le64(record, i);
+		store_le32(record + FILE_HEADER_SIZE, (uint32_t)i);
+
+		if (fwrite(record, sizeof(record), 1, stdout) != 1)
+			return 1;
+	}
+
+	if (fflush(stdout) != 0)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * Blob store layout (all integers little endian):
+ *
+ *  - encoded images, each starting at a 16 byte aligned offset
+ *  - index of struct blob_record, sorted by checksum in Eytzinger order
+ *    (children of entry k are 2k and 2k + 1 when counting from 1)
+ *  - struct blob_trailer at the end of the file
+ *
+ * The index is 16 byte aligned too and can be searched in place after the
+ * file was mapped into memory.
+ */
+
+#include "gliden64_cache_extract.h"
+#include "probes.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef __WIN32__
+#include <sys/mman.h>
+#endif
+
+#define BLOB_MAGIC "GLN64BLB"
+#define BLOB_ALIGNMENT 16
+
+#pragma pack(push, 1)
+struct blob_record {
+	uint64_t checksum;
+	uint64_t offset;
+	uint32_t size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+};
+
+struct blob_trailer {
+	char magic[8];
+	uint64_t index_offset;
+	uint64_t count;
+	uint32_t record_size;
+	uint32_t image_format;
+};
+#pragma pack(pop)
+
+static struct {
+	struct blob_record *records;
+	size_t count;
+	size_t capacity;
+	uint64_t offset;
+} blob;
+
+static int blob_pad(void)
+{
+	size_t padding_size;
+
+	padding_size = (size_t)(blob.offset % BLOB_ALIGNMENT);
+	if (!padding_size)
+		return 0;
+
+	padding_size = BLOB_ALIGNMENT - padding_size;
+	blob.offset += padding_size;
+
+	return output_write(tarblock, padding_size);
+}
+
+static int blob_compare_record(const void *a, const void *b)
+{
+	const struct blob_record *record_a = a;
+	const struct blob_record *record_b = b;
+
+	if (record_a->checksum < record_b->checksum)
+		return -1;
+	if (record_a->checksum > record_b->checksum)
+		return 1;
+
+	/* keep the first copy of a duplicated checksum */
+	if (record_a->offset < record_b->offset)
+		return -1;
+	if (record_a->offset > record_b->offset)
+		return 1;
+
+	return 0;
+}
+
+int blob_store_add(const struct gliden64_file *file)
+{
+	struct blob_record *records;
+	struct blob_record *record;
+	int ret;
+
+	if (blob.count == blob.capacity) {
+		blob.capacity = blob.capacity ? blob.capacity * 2 : 256;
+		records = realloc(blob.records, blob.capacity * sizeof(*records));
+		if (!records) {
+			fprintf(stderr, "Memory for blob index couldn't be allocated\n");
+			return -ENOMEM;
+		}
+		blob.records = records;
+	}
+
+	record = &blob.records[blob.count];
+	record->checksum = file->checksum;
+	record->offset = blob.offset;
+	record->size = file->size;
+	record->width = file->width;
+	record->height = file->height;
+	record->format = file->source_format;
+
+	PROBE2(blob__write, file->size, blob.offset);
+	ret = output_write(file->data, file->size);
+	if (ret < 0)
+		return ret;
+
+	blob.offset += file->size;
+	blob.count++;
+
+	return blob_pad();
+}
+
+/* in-order walk of the implicit tree places the sorted records */
+static size_t blob_eytzinger(const struct blob_record *sorted,
+			     struct blob_record *out, size_t i, size_t k)
+{
+	if (k > blob.count)
+		return i;
+
+	i = blob_eytzinger(sorted, out, i, 2 * k);
+	out[k - 1].checksum = htole64(sorted[i].checksum);
+	out[k - 1].offset = htole64(sorted[i].offset);
+	out[k - 1].size = htole32(sorted[i].size);
+	out[k - 1].width = htole32(sorted[i].width);
+	out[k - 1].height = htole32(sorted[i].height);
+	out[k - 1].format = htole32(sorted[i].format);
+	i++;
+
+	return blob_eytzinger(sorted, out, i, 2 * k + 1);
+}
+
+int blob_store_finish(void)
+{
+	struct blob_trailer trailer;
+	struct blob_record *index;
+	size_t i, unique = 0;
+	int ret;
+
+	qsort(blob.records, blob.count, sizeof(*blob.records), blob_compare_record);
+
+	/* the index is keyed by checksum - later duplicates are unreachable */
+	for (i = 0; i < blob.count; i++) {
+		if (unique && blob.records[unique - 1].checksum == blob.records[i].checksum)
+			continue;
+
+		blob.records[unique++] = blob.records[i];
+	}
+	blob.count = unique;
+
+	index = calloc(blob.count + 1, sizeof(*index));
+	if (!index) {
+		fprintf(stderr, "Memory for blob index couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	blob_eytzinger(blob.records, index, 0, 1);
+
+	ret = output_write(index, blob.count * sizeof(*index));
+	free(index);
+	if (ret < 0)
+		return ret;
+
+	memset(&trailer, 0, sizeof(trailer));
+	memcpy(trailer.magic, BLOB_MAGIC, sizeof(trailer.magic));
+	trailer.index_offset = htole64(blob.offset);
+	trailer.count = htole64(blob.count);
+	trailer.record_size = htole32(sizeof(struct blob_record));
+	trailer.image_format = htole32(globals.image_format);
+
+	ret = output_write(&trailer, sizeof(trailer));
+	if (ret < 0)
+		return ret;
+
+	free(blob.records);
+	blob.records = NULL;
+	blob.count = 0;
+	blob.capacity = 0;
+
+	return 0;
+}
+
+static const struct blob_record *blob_search(const struct blob_record *index,
+					     uint64_t count, uint64_t checksum)
+{
+	uint64_t k = 1;
+
+	/* branchless descent, the final right turns are stripped afterwards */
+	while (k <= count)
+		k = 2 * k + (le64toh(index[k - 1].checksum) < checksum);
+
+	k >>= __builtin_ffsll((long long)~k);
+	if (k == 0 || le64toh(index[k - 1].checksum) != checksum)
+		return NULL;
+
+	return &index[k - 1];
+}
+
+#ifndef __WIN32__
+int blob_store_lookup(uint64_t checksum)
+{
+	const struct blob_trailer *trailer;
+	const struct blob_record *index;
+	const struct blob_record *record;
+	const uint8_t *map;
+	uint64_t index_offset, count, offset;
+	uint32_t size;
+	struct stat st;
+	int fd = fileno(globals.in);
+	int ret;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (uint64_t)st.st_size < sizeof(*trailer)) {
+		fprintf(stderr, "Blob store must be a regular file\n");
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		ret = -errno;
+		fprintf(stderr, "Could not map blob store\n");
+		return ret;
+	}
+
+	trailer = (const void *)(map + st.st_size - sizeof(*trailer));
+	index_offset = le64toh(trailer->index_offset);
+	count = le64toh(trailer->count);
+
+	if (memcmp(trailer->magic, BLOB_MAGIC, sizeof(trailer->magic)) != 0 ||
+	    le32toh(trailer->record_size) != sizeof(*record) ||
+	    index_offset % BLOB_ALIGNMENT != 0 ||
+	    count > ((uint64_t)st.st_size - sizeof(*trailer)) / sizeof(*record) ||
+	    index_offset + count * sizeof(*record) != (uint64_t)st.st_size - sizeof(*trailer)) {
+		fprintf(stderr, "Invalid blob store trailer\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	index = (const void *)(map + index_offset);
+	record = blob_search(index, count, checksum);
+	if (!record) {
+		fprintf(stderr, "Checksum %016"PRIX64" not found in blob store\n", checksum);
+		ret = -ENOENT;
+		goto out;
+	}
+
+	offset = le64toh(record->offset);
+	size = le32toh(record->size);
+	if (offset > index_offset || size > index_offset - offset) {
+		fprintf(stderr, "Invalid blob store record\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (globals.verbose >= VERBOSITY_FILE_HEADER) {
+		fprintf(stderr, "Blob:\n");
+		fprintf(stderr, "\tchecksum: 0x%016"PRIX64"\n", checksum);
+		fprintf(stderr, "\toffset: %#"PRIx64"\n", offset);
+		fprintf(stderr, "\tsize: %"PRIu32"\n", size);
+		fprintf(stderr, "\twidth: %"PRIu32"\n", le32toh(record->width));
+		fprintf(stderr, "\theight: %"PRIu32"\n", le32toh(record->height));
+		fprintf(stderr, "\tformat: %#"PRIx32"\n", le32toh(record->format));
+		fprintf(stderr, "\n");
+	}
+
+	ret = output_write(map + offset, size);
+	if (ret == 0)
+		ret = output_flush();
+
+out:
+	munmap((void *)map, (size_t)st.st_size);
+
+	return ret;
+}
+#else
+int blob_store_lookup(uint64_t checksum)
+{
+	(void)checksum;
+
+	fprintf(stderr, "Blob store lookups are not supported on this platform\n");
+	return -EOPNOTSUPP;
+}
+#endif
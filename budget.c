@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+	uint64_t fixed;
+	uint64_t dynamic;
+	unsigned int in_flight;
+} budget = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.released = PTHREAD_COND_INITIALIZER,
+};
+
+int budget_parse(const char *str, uint64_t *bytes)
+{
+	uint64_t value, factor = 1;
+	char *end;
+
+	value = strtoull(str, &end, 0);
+	if (end == str)
+		return -EINVAL;
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		factor = 1024ULL;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		factor = 1024ULL * 1024;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		factor = 1024ULL * 1024 * 1024;
+		end++;
+		break;
+	}
+
+	if (*end != '\0' || value == 0 || value > UINT64_MAX / factor)
+		return -EINVAL;
+
+	*bytes = value * factor;
+
+	return 0;
+}
+
+/* buffers which stay allocated for the whole run (read ahead rings, atlas) */
+int budget_reserve_static(uint64_t size)
+{
+	int ret = 0;
+
+	if (!globals.max_memory)
+		return 0;
+
+	pthread_mutex_lock(&budget.lock);
+	if (budget.fixed + budget.dynamic + size > globals.max_memory) {
+		fprintf(stderr, "Memory budget exhausted by %"PRIu64" bytes of buffers\n", size);
+		ret = -ENOMEM;
+	} else {
+		budget.fixed += size;
+	}
+	pthread_mutex_unlock(&budget.lock);
+
+	return ret;
+}
+
+/* buffers which were freed again or never allocated */
+void budget_release_static(uint64_t size)
+{
+	if (!globals.max_memory)
+		return;
+
+	pthread_mutex_lock(&budget.lock);
+	budget.fixed -= size;
+	pthread_mutex_unlock(&budget.lock);
+}
+
+/* waits until the other files in flight released enough memory. A file
+ * which doesn't even fit into an otherwise empty budget is rejected
+ */
+int budget_reserve(uint64_t size)
+{
+	int ret = 0;
+
+	if (!globals.max_memory)
+		return 0;
+
+	pthread_mutex_lock(&budget.lock);
+	while (budget.in_flight > 0 &&
+	       budget.fixed + budget.dynamic + size > globals.max_memory)
+		pthread_cond_wait(&budget.released, &budget.lock);
+
+	if (budget.fixed + budget.dynamic + size > globals.max_memory) {
+		ret = -ENOMEM;
+	} else {
+		budget.dynamic += size;
+		budget.in_flight++;
+	}
+	pthread_mutex_unlock(&budget.lock);
+
+	return ret;
+}
+
+void budget_usage(uint64_t *fixed, uint64_t *dynamic)
+{
+	pthread_mutex_lock(&budget.lock);
+	*fixed = budget.fixed;
+	*dynamic = budget.dynamic;
+	pthread_mutex_unlock(&budget.lock);
+}
+
+void budget_release(uint64_t size)
+{
+	if (!globals.max_memory)
+		return;
+
+	pthread_mutex_lock(&budget.lock);
+	budget.dynamic -= size;
+	budget.in_flight--;
+	pthread_cond_broadcast(&budget.released);
+	pthread_mutex_unlock(&budget.lock);
+}
@@ -0,0 +1,865 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * Catalog layout (all integers little endian, all sections 8 byte aligned):
+ *
+ *  - struct catalog_header
+ *  - struct catalog_cache for each indexed cache file
+ *  - struct catalog_entry for each file of all caches, sorted by checksum,
+ *    cache and offset
+ *  - the cache paths (not zero terminated)
+ *  - a Bloom filter for each cache
+ *
+ * An update only rescans the caches which changed in size, mtime or inode
+ * since they were cataloged. The entries of all other caches are copied.
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __WIN32__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CATALOG_MAGIC "GLN64CAT"
+#define CATALOG_VERSION 1
+#define CATALOG_BLOOM_BITS_PER_ENTRY 10
+#define CATALOG_BLOOM_MIN_BITS 512
+#define CATALOG_BLOOM_HASHES 7
+
+#pragma pack(push, 1)
+struct catalog_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t caches_count;
+	uint64_t entries_count;
+	uint64_t caches_offset;
+	uint64_t entries_offset;
+	uint64_t names_offset;
+	uint64_t names_size;
+	uint64_t blooms_offset;
+	uint64_t blooms_size;
+};
+
+struct catalog_cache {
+	uint64_t size;
+	int64_t mtime;
+	uint64_t inode;
+	uint64_t entries_count;
+	uint64_t bloom_offset;
+	uint32_t bloom_bits;
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint32_t reserved;
+};
+
+struct catalog_entry {
+	uint64_t checksum;
+	uint64_t offset;
+	uint32_t size;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t cache;
+	uint32_t reserved;
+};
+#pragma pack(pop)
+
+struct catalog_source {
+	char *path;
+	uint64_t size;
+	int64_t mtime;
+	uint64_t inode;
+	uint64_t entries_count;
+	/* index in the previous catalog or -1 when it has to be scanned */
+	long old_index;
+};
+
+/* catalog in host byte order while it is built */
+static struct {
+	struct catalog_source *sources;
+	unsigned int sources_count;
+	struct catalog_entry *entries;
+	size_t count;
+	size_t capacity;
+} catalog;
+
+/* mapped catalog file */
+struct catalog_map {
+	const uint8_t *data;
+	size_t size;
+	const struct catalog_header *header;
+	const struct catalog_cache *caches;
+	const struct catalog_entry *entries;
+	const char *names;
+	const uint8_t *blooms;
+	uint32_t caches_count;
+	uint64_t entries_count;
+};
+
+static uint64_t catalog_align(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+static void catalog_unmap(struct catalog_map *map)
+{
+	if (map->data)
+		munmap((void *)map->data, map->size);
+
+	memset(map, 0, sizeof(*map));
+}
+
+static int catalog_section_valid(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+	return offset % 8 == 0 && offset <= file_size && size <= file_size - offset;
+}
+
+/* returns -ENOENT when there is no catalog yet */
+static int catalog_map(const char *path, struct catalog_map *map)
+{
+	const struct catalog_header *header;
+	const struct catalog_cache *cache;
+	uint64_t names_size, blooms_size;
+	uint64_t entries = 0;
+	struct stat st;
+	uint32_t i;
+	int fd;
+	int ret;
+
+	memset(map, 0, sizeof(*map));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (uint64_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		fprintf(stderr, "Invalid catalog %s\n", path);
+		return -EINVAL;
+	}
+
+	map->size = (size_t)st.st_size;
+	map->data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map->data == MAP_FAILED) {
+		ret = -errno;
+		close(fd);
+		map->data = NULL;
+		fprintf(stderr, "Could not map catalog %s\n", path);
+		return ret;
+	}
+	close(fd);
+
+	header = (const void *)map->data;
+	map->header = header;
+	map->caches_count = le32toh(header->caches_count);
+	map->entries_count = le64toh(header->entries_count);
+	names_size = le64toh(header->names_size);
+	blooms_size = le64toh(header->blooms_size);
+
+	if (memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) != 0 ||
+	    le32toh(header->version) != CATALOG_VERSION ||
+	    map->entries_count > map->size / sizeof(*map->entries) ||
+	    !catalog_section_valid(le64toh(header->caches_offset),
+				   (uint64_t)map->caches_count * sizeof(*map->caches),
+				   map->size) ||
+	    !catalog_section_valid(le64toh(header->entries_offset),
+				   map->entries_count * sizeof(*map->entries),
+				   map->size) ||
+	    !catalog_section_valid(le64toh(header->names_offset), names_size, map->size) ||
+	    !catalog_section_valid(le64toh(header->blooms_offset), blooms_size, map->size))
+		goto invalid;
+
+	map->caches = (const void *)(map->data + le64toh(header->caches_offset));
+	map->entries = (const void *)(map->data + le64toh(header->entries_offset));
+	map->names = (const char *)(map->data + le64toh(header->names_offset));
+	map->blooms = map->data + le64toh(header->blooms_offset);
+
+	for (i = 0; i < map->caches_count; i++) {
+		cache = &map->caches[i];
+
+		/* the bloom filters are indexed with a power of two mask */
+		if (le32toh(cache->bloom_bits) < 8 ||
+		    (le32toh(cache->bloom_bits) & (le32toh(cache->bloom_bits) - 1)) ||
+		    le64toh(cache->bloom_offset) > blooms_size ||
+		    le32toh(cache->bloom_bits) / 8 > blooms_size - le64toh(cache->bloom_offset) ||
+		    le32toh(cache->name_offset) > names_size ||
+		    le32toh(cache->name_length) > names_size - le32toh(cache->name_offset) ||
+		    le64toh(cache->entries_count) > map->entries_count - entries)
+			goto invalid;
+
+		entries += le64toh(cache->entries_count);
+	}
+
+	if (entries != map->entries_count)
+		goto invalid;
+
+	return 0;
+
+invalid:
+	catalog_unmap(map);
+	fprintf(stderr, "Invalid catalog %s\n", path);
+
+	return -EINVAL;
+}
+
+static char *catalog_cache_path(const struct catalog_map *map, uint32_t cache)
+{
+	const struct catalog_cache *info = &map->caches[cache];
+	char *path;
+	size_t len = le32toh(info->name_length);
+
+	path = malloc(len + 1);
+	if (!path)
+		return NULL;
+
+	memcpy(path, map->names + le32toh(info->name_offset), len);
+	path[len] = '\0';
+
+	return path;
+}
+
+/* two independent hashes of the checksum for double hashing */
+static void catalog_bloom_hashes(uint64_t checksum, uint32_t *h1, uint32_t *h2)
+{
+	uint64_t z = checksum;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+
+	*h1 = (uint32_t)z;
+	*h2 = (uint32_t)(z >> 32) | 1;
+}
+
+static void catalog_bloom_add(uint8_t *bloom, uint32_t bits, uint64_t checksum)
+{
+	uint32_t h1, h2, bit;
+	unsigned int i;
+
+	catalog_bloom_hashes(checksum, &h1, &h2);
+	for (i = 0; i < CATALOG_BLOOM_HASHES; i++) {
+		bit = (h1 + i * h2) & (bits - 1);
+		bloom[bit / 8] |= (uint8_t)(1U << (bit % 8));
+	}
+}
+
+static int catalog_bloom_test(const uint8_t *bloom, uint32_t bits, uint64_t checksum)
+{
+	uint32_t h1, h2, bit;
+	unsigned int i;
+
+	catalog_bloom_hashes(checksum, &h1, &h2);
+	for (i = 0; i < CATALOG_BLOOM_HASHES; i++) {
+		bit = (h1 + i * h2) & (bits - 1);
+		if (!(bloom[bit / 8] & (1U << (bit % 8))))
+			return 0;
+	}
+
+	return 1;
+}
+
+static uint32_t catalog_bloom_bits(uint64_t entries)
+{
+	uint64_t bits = CATALOG_BLOOM_MIN_BITS;
+
+	while (bits < entries * CATALOG_BLOOM_BITS_PER_ENTRY && bits < (1ULL << 31))
+		bits *= 2;
+
+	return (uint32_t)bits;
+}
+
+static int catalog_compare_entry(const void *a, const void *b)
+{
+	const struct catalog_entry *entry_a = a;
+	const struct catalog_entry *entry_b = b;
+
+	if (entry_a->checksum < entry_b->checksum)
+		return -1;
+	if (entry_a->checksum > entry_b->checksum)
+		return 1;
+
+	if (entry_a->cache < entry_b->cache)
+		return -1;
+	if (entry_a->cache > entry_b->cache)
+		return 1;
+
+	if (entry_a->offset < entry_b->offset)
+		return -1;
+	if (entry_a->offset > entry_b->offset)
+		return 1;
+
+	return 0;
+}
+
+static struct catalog_entry *catalog_add_entry(void)
+{
+	struct catalog_entry *entries;
+
+	if (catalog.count == catalog.capacity) {
+		catalog.capacity = catalog.capacity ? catalog.capacity * 2 : 1024;
+		entries = realloc(catalog.entries, catalog.capacity * sizeof(*entries));
+		if (!entries) {
+			fprintf(stderr, "Memory for catalog couldn't be allocated\n");
+			return NULL;
+		}
+		catalog.entries = entries;
+	}
+
+	return &catalog.entries[catalog.count++];
+}
+
+static int catalog_add_source(char *path, const struct stat *st, long old_index)
+{
+	struct catalog_source *sources;
+	struct catalog_source *source;
+	unsigned int i;
+
+	/* the same cache can be listed again - it is then only refreshed */
+	for (i = 0; i < catalog.sources_count; i++) {
+		if (strcmp(catalog.sources[i].path, path) == 0) {
+			free(path);
+			return 0;
+		}
+	}
+
+	sources = realloc(catalog.sources, (catalog.sources_count + 1) * sizeof(*sources));
+	if (!sources) {
+		free(path);
+		fprintf(stderr, "Memory for catalog couldn't be allocated\n");
+		return -ENOMEM;
+	}
+	catalog.sources = sources;
+
+	source = &catalog.sources[catalog.sources_count++];
+	source->path = path;
+	source->size = (uint64_t)st->st_size;
+	source->mtime = (int64_t)st->st_mtime;
+	source->inode = (uint64_t)st->st_ino;
+	source->entries_count = 0;
+	source->old_index = old_index;
+
+	return 0;
+}
+
+/* walks over the file headers and skips the contents */
+static int catalog_scan(unsigned int cache)
+{
+	struct catalog_source *source = &catalog.sources[cache];
+	struct catalog_entry *entry;
+	struct gliden64_file file;
+	uint32_t config;
+	FILE *in;
+	long pos;
+	int ret;
+
+	in = fopen(source->path, "rb");
+	if (!in) {
+		fprintf(stderr, "Could not open input file %s\n", source->path);
+		return -ENOENT;
+	}
+
+	input_set_file(in);
+
+	ret = get_item(config);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to read config header of %s\n", source->path);
+		goto out;
+	}
+
+	if (config & FILE_CACHE_MASK) {
+		fprintf(stderr, "TexStream format of %s not supported\n", source->path);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (;;) {
+		pos = input_tell();
+		ret = read_file_header(&file);
+		if (ret > 0) {
+			ret = 0;
+			break;
+		}
+
+		if (ret == 0 && pos < 0)
+			ret = -EIO;
+
+		if (ret == 0)
+			ret = input_skip(file.size, 1);
+
+		if (ret < 0) {
+			fprintf(stderr, "Failed to catalog %s\n", source->path);
+			goto out;
+		}
+
+		entry = catalog_add_entry();
+		if (!entry) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		entry->checksum = file.checksum;
+		entry->offset = (uint64_t)pos;
+		entry->size = file.size;
+		entry->format = file.format;
+		entry->width = file.width;
+		entry->height = file.height;
+		entry->cache = cache;
+		entry->reserved = 0;
+		source->entries_count++;
+	}
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Cataloged %s: %"PRIu64" files\n", source->path,
+			source->entries_count);
+
+out:
+	input_set_file(stdin);
+	fclose(in);
+
+	return ret;
+}
+
+static int catalog_copy_entry(const struct catalog_map *map,
+			      const unsigned int *cache_map,
+			      const struct catalog_entry *old)
+{
+	uint32_t old_cache = le32toh(old->cache);
+
+	return old_cache < map->caches_count && cache_map[old_cache] != UINT_MAX;
+}
+
+static int catalog_copy(const struct catalog_map *map, const unsigned int *cache_map)
+{
+	const struct catalog_entry *old;
+	struct catalog_entry *entry;
+	uint32_t old_cache;
+	uint64_t copied = 0;
+	uint64_t i;
+
+	/* the entries are counted - the cache headers of the old catalog
+	 * don't have to match them
+	 */
+	for (i = 0; i < map->entries_count; i++) {
+		if (catalog_copy_entry(map, cache_map, &map->entries[i]))
+			copied++;
+	}
+
+	if (!copied)
+		return 0;
+
+	catalog.entries = malloc((size_t)copied * sizeof(*catalog.entries));
+	if (!catalog.entries) {
+		fprintf(stderr, "Memory for catalog couldn't be allocated\n");
+		return -ENOMEM;
+	}
+	catalog.capacity = (size_t)copied;
+
+	for (i = 0; i < map->entries_count; i++) {
+		old = &map->entries[i];
+		if (!catalog_copy_entry(map, cache_map, old))
+			continue;
+
+		old_cache = le32toh(old->cache);
+		entry = &catalog.entries[catalog.count++];
+		entry->checksum = le64toh(old->checksum);
+		entry->offset = le64toh(old->offset);
+		entry->size = le32toh(old->size);
+		entry->format = le32toh(old->format);
+		entry->width = le32toh(old->width);
+		entry->height = le32toh(old->height);
+		entry->cache = cache_map[old_cache];
+		entry->reserved = 0;
+		catalog.sources[cache_map[old_cache]].entries_count++;
+	}
+
+	return 0;
+}
+
+static int catalog_write_all(FILE *f, const void *data, size_t size)
+{
+	if (size && fwrite(data, 1, size, f) != size)
+		return -EIO;
+
+	return 0;
+}
+
+static int catalog_write(const char *path)
+{
+	struct catalog_header header;
+	struct catalog_cache *caches = NULL;
+	struct catalog_entry entry;
+	uint8_t *blooms = NULL;
+	char tmp_path[4096];
+	uint64_t names_size = 0, blooms_size = 0;
+	size_t i;
+	unsigned int cache;
+	FILE *f;
+	int ret = 0;
+
+	caches = calloc(catalog.sources_count + 1, sizeof(*caches));
+	if (!caches) {
+		fprintf(stderr, "Memory for catalog couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	for (cache = 0; cache < catalog.sources_count; cache++) {
+		struct catalog_source *source = &catalog.sources[cache];
+		uint32_t bits = catalog_bloom_bits(source->entries_count);
+
+		caches[cache].size = htole64(source->size);
+		caches[cache].mtime = (int64_t)htole64((uint64_t)source->mtime);
+		caches[cache].inode = htole64(source->inode);
+		caches[cache].entries_count = htole64(source->entries_count);
+		caches[cache].bloom_offset = htole64(blooms_size);
+		caches[cache].bloom_bits = htole32(bits);
+		caches[cache].name_offset = htole32((uint32_t)names_size);
+		caches[cache].name_length = htole32((uint32_t)strlen(source->path));
+
+		names_size += strlen(source->path);
+		blooms_size += bits / 8;
+	}
+
+	blooms = calloc(1, blooms_size + 1);
+	if (!blooms) {
+		free(caches);
+		fprintf(stderr, "Memory for catalog couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < catalog.count; i++) {
+		cache = catalog.entries[i].cache;
+		catalog_bloom_add(blooms + le64toh(caches[cache].bloom_offset),
+				  le32toh(caches[cache].bloom_bits),
+				  catalog.entries[i].checksum);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+	header.version = htole32(CATALOG_VERSION);
+	header.caches_count = htole32(catalog.sources_count);
+	header.entries_count = htole64(catalog.count);
+	header.caches_offset = htole64(sizeof(header));
+	header.entries_offset = htole64(sizeof(header) +
+					(uint64_t)catalog.sources_count * sizeof(*caches));
+	header.names_offset = htole64(le64toh(header.entries_offset) +
+				      (uint64_t)catalog.count * sizeof(entry));
+	header.names_size = htole64(names_size);
+	header.blooms_offset = htole64(catalog_align(le64toh(header.names_offset) + names_size));
+	header.blooms_size = htole64(blooms_size);
+
+	/* an interrupted update never leaves a truncated catalog behind */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	f = fopen(tmp_path, "wb");
+	if (!f) {
+		fprintf(stderr, "Could not open catalog file %s\n", tmp_path);
+		ret = -ENOENT;
+		goto out;
+	}
+
+	ret = catalog_write_all(f, &header, sizeof(header));
+	if (ret == 0)
+		ret = catalog_write_all(f, caches, catalog.sources_count * sizeof(*caches));
+
+	for (i = 0; ret == 0 && i < catalog.count; i++) {
+		entry.checksum = htole64(catalog.entries[i].checksum);
+		entry.offset = htole64(catalog.entries[i].offset);
+		entry.size = htole32(catalog.entries[i].size);
+		entry.format = htole32(catalog.entries[i].format);
+		entry.width = htole32(catalog.entries[i].width);
+		entry.height = htole32(catalog.entries[i].height);
+		entry.cache = htole32(catalog.entries[i].cache);
+		entry.reserved = 0;
+		ret = catalog_write_all(f, &entry, sizeof(entry));
+	}
+
+	for (cache = 0; ret == 0 && cache < catalog.sources_count; cache++)
+		ret = catalog_write_all(f, catalog.sources[cache].path,
+					strlen(catalog.sources[cache].path));
+
+	if (ret == 0)
+		ret = catalog_write_all(f, tarblock,
+					(size_t)(le64toh(header.blooms_offset) -
+						 le64toh(header.names_offset) - names_size));
+	if (ret == 0)
+		ret = catalog_write_all(f, blooms, blooms_size);
+
+	if (fclose(f) != 0)
+		ret = -EIO;
+
+	if (ret == 0 && rename(tmp_path, path) != 0)
+		ret = -EIO;
+
+	if (ret < 0) {
+		fprintf(stderr, "Could not write catalog %s\n", path);
+		unlink(tmp_path);
+	}
+
+out:
+	free(blooms);
+	free(caches);
+
+	return ret;
+}
+
+static int catalog_update(const char *path, char *paths[], unsigned int count)
+{
+	struct catalog_map map;
+	unsigned int *cache_map = NULL;
+	uint64_t reused = 0;
+	unsigned int changed = 0;
+	char *cache_path;
+	struct stat st;
+	unsigned int cache, i;
+	int ret;
+
+	ret = catalog_map(path, &map);
+	if (ret < 0 && ret != -ENOENT)
+		return ret;
+
+	/* previously cataloged caches are kept while they still exist */
+	for (i = 0; i < map.caches_count; i++) {
+		const struct catalog_cache *old = &map.caches[i];
+		long old_index = -1;
+
+		cache_path = catalog_cache_path(&map, i);
+		if (!cache_path) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		if (stat(cache_path, &st) < 0) {
+			if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+				fprintf(stderr, "Removed %s from catalog\n", cache_path);
+			free(cache_path);
+			changed++;
+			continue;
+		}
+
+		if (le64toh(old->size) == (uint64_t)st.st_size &&
+		    (int64_t)le64toh((uint64_t)old->mtime) == (int64_t)st.st_mtime &&
+		    le64toh(old->inode) == (uint64_t)st.st_ino)
+			old_index = (long)i;
+
+		ret = catalog_add_source(cache_path, &st, old_index);
+		if (ret < 0)
+			goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		cache_path = realpath(paths[i], NULL);
+		if (!cache_path || stat(cache_path, &st) < 0) {
+			free(cache_path);
+			fprintf(stderr, "Could not open input file %s\n", paths[i]);
+			ret = -ENOENT;
+			goto out;
+		}
+
+		ret = catalog_add_source(cache_path, &st, -1);
+		if (ret < 0)
+			goto out;
+	}
+
+	/* unchanged caches keep their entries from the previous catalog */
+	cache_map = malloc((map.caches_count + 1) * sizeof(*cache_map));
+	if (!cache_map) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < map.caches_count; i++)
+		cache_map[i] = UINT_MAX;
+
+	for (cache = 0; cache < catalog.sources_count; cache++) {
+		if (catalog.sources[cache].old_index < 0)
+			continue;
+
+		cache_map[catalog.sources[cache].old_index] = cache;
+		reused += le64toh(map.caches[catalog.sources[cache].old_index].entries_count);
+	}
+
+	if (reused) {
+		ret = catalog_copy(&map, cache_map);
+		if (ret < 0)
+			goto out;
+	}
+
+	for (cache = 0; cache < catalog.sources_count; cache++) {
+		if (catalog.sources[cache].old_index >= 0) {
+			if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+				fprintf(stderr, "Unchanged %s: %"PRIu64" files\n",
+					catalog.sources[cache].path,
+					catalog.sources[cache].entries_count);
+			continue;
+		}
+
+		ret = catalog_scan(cache);
+		if (ret < 0)
+			goto out;
+
+		changed++;
+	}
+
+	/* an unchanged catalog doesn't have to be sorted and written again */
+	if (!changed && map.data) {
+		ret = 0;
+		goto out;
+	}
+
+	qsort(catalog.entries, catalog.count, sizeof(*catalog.entries),
+	      catalog_compare_entry);
+
+	ret = catalog_write(path);
+	if (ret == 0 && globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Catalog lists %zu files of %u caches\n",
+			catalog.count, catalog.sources_count);
+
+out:
+	catalog_unmap(&map);
+	free(cache_map);
+	for (cache = 0; cache < catalog.sources_count; cache++)
+		free(catalog.sources[cache].path);
+	free(catalog.sources);
+	free(catalog.entries);
+	memset(&catalog, 0, sizeof(catalog));
+
+	return ret;
+}
+
+static int catalog_print_entry(const struct catalog_map *map,
+			       const struct catalog_entry *entry)
+{
+	const struct catalog_cache *cache;
+	char line[512];
+	uint32_t index = le32toh(entry->cache);
+	int len;
+
+	if (index >= map->caches_count)
+		return -EINVAL;
+
+	cache = &map->caches[index];
+	len = snprintf(line, sizeof(line), "%016"PRIX64" %#"PRIx64" %"PRIu32" %"PRIu32"x%"PRIu32" %#"PRIx32" ",
+		       le64toh(entry->checksum), le64toh(entry->offset),
+		       le32toh(entry->size), le32toh(entry->width),
+		       le32toh(entry->height), le32toh(entry->format));
+
+	if (output_write(line, (size_t)len) < 0 ||
+	    output_write(map->names + le32toh(cache->name_offset),
+			 le32toh(cache->name_length)) < 0 ||
+	    output_write("\n", 1) < 0)
+		return -EIO;
+
+	return 0;
+}
+
+static int catalog_query(const struct catalog_map *map, uint64_t checksum)
+{
+	const struct catalog_cache *cache;
+	uint64_t low = 0, high = map->entries_count, mid;
+	uint32_t i;
+	int maybe = 0;
+	int ret;
+
+	/* most misses are answered without touching the sorted entries */
+	for (i = 0; i < map->caches_count && !maybe; i++) {
+		cache = &map->caches[i];
+		maybe = catalog_bloom_test(map->blooms + le64toh(cache->bloom_offset),
+					   le32toh(cache->bloom_bits), checksum);
+	}
+
+	while (maybe && low < high) {
+		mid = low + (high - low) / 2;
+		if (le64toh(map->entries[mid].checksum) < checksum)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (!maybe || low == map->entries_count ||
+	    le64toh(map->entries[low].checksum) != checksum) {
+		fprintf(stderr, "Checksum %016"PRIX64" not found in catalog\n", checksum);
+		return -ENOENT;
+	}
+
+	for (; low < map->entries_count &&
+	       le64toh(map->entries[low].checksum) == checksum; low++) {
+		ret = catalog_print_entry(map, &map->entries[low]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return output_flush();
+}
+
+/* prints all files of checksums which are stored in more than one cache */
+static int catalog_shared(const struct catalog_map *map)
+{
+	uint64_t start, end, i;
+	int ret;
+
+	for (start = 0; start < map->entries_count; start = end) {
+		int shared = 0;
+
+		for (end = start + 1; end < map->entries_count &&
+		     map->entries[end].checksum == map->entries[start].checksum; end++) {
+			if (map->entries[end].cache != map->entries[start].cache)
+				shared = 1;
+		}
+
+		for (i = start; shared && i < end; i++) {
+			ret = catalog_print_entry(map, &map->entries[i]);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return output_flush();
+}
+
+int catalog_run(char *paths[], unsigned int count)
+{
+	struct catalog_map map;
+	int ret;
+
+	if (!globals.catalog_query && !globals.catalog_shared)
+		return catalog_update(globals.catalog, paths, count);
+
+	ret = catalog_map(globals.catalog, &map);
+	if (ret == -ENOENT)
+		fprintf(stderr, "Could not open catalog %s\n", globals.catalog);
+	if (ret < 0)
+		return ret;
+
+	if (globals.catalog_query)
+		ret = catalog_query(&map, globals.catalog_checksum);
+	else
+		ret = catalog_shared(&map);
+
+	catalog_unmap(&map);
+
+	return ret;
+}
+#else
+int catalog_run(char *paths[], unsigned int count)
+{
+	(void)paths;
+	(void)count;
+
+	fprintf(stderr, "Catalogs are not supported on this platform\n");
+	return -EOPNOTSUPP;
+}
+#endif
@@ -5,6 +5,7 @@
  */
 
 #include "gliden64_cache_extract.h"
+#include "probes.h"
 #include <errno.h>
 #include <inttypes.h>
 #include <stddef.h>
@@ -12,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <zlib.h>
 
 #pragma pack(push, 1)
@@ -73,84 +75,196 @@ struct bmp_header_v5 {
 };
 #pragma pack(pop)
 
-static size_t image_content_length(const struct gliden64_file *file)
+/* bytes per pixel of the uncompressed content, 0 for unsupported formats */
+unsigned int texture_bytes_per_pixel(uint32_t format)
 {
-	size_t size;
-
-	switch (file->format & ~GR_TEXFMT_GZ) {
+	switch (format & ~GR_TEXFMT_GZ) {
 	case GR_RGBA8:
-		size = file->width * file->height * 4;
-		break;
+		return 4;
 	case GR_RGB:
-		size = file->width * file->height * 2;
-		break;
 	case GR_RGBA4:
-		size = file->width * file->height * 2;
-		break;
 	case GR_RGB5_A1:
-		size = file->width * file->height * 2;
-		break;
+		return 2;
 	default:
-		size = 0;
+		return 0;
+	}
+}
+
+static uint64_t image_content_length(const struct gliden64_file *file)
+{
+	unsigned int bytes_per_pixel = texture_bytes_per_pixel(file->format);
+
+	if (!bytes_per_pixel)
 		fprintf(stderr, "Unsupported format %#"PRIx32"\n", file->format);
-		break;
+
+	return (uint64_t)file->width * file->height * bytes_per_pixel;
+}
+
+/* upper bound of the memory which is held at the same time while a file
+ * is decompressed, converted to BGRA and encoded
+ */
+uint64_t image_memory_estimate(const struct gliden64_file *file)
+{
+	uint64_t content, bgra, peak, stage;
+
+	content = image_content_length(file);
+	bgra = (uint64_t)file->width * file->height * 4;
+
+	peak = file->size;
+	if (file->format & GR_TEXFMT_GZ)
+		peak += content + 4096;
+
+	stage = content + bgra;
+	if (stage > peak)
+		peak = stage;
+
+	/* the encoded image is never larger than BGRA plus its header */
+	stage = bgra + bgra + 256;
+	if (globals.adaptive)
+		stage += (uint64_t)file->width * file->height + 1024;
+	if (stage > peak)
+		peak = stage;
+
+	return peak;
+}
+
+struct bmp_pixel_format {
+	uint16_t bitperpixel;
+	uint32_t redmask;
+	uint32_t greenmask;
+	uint32_t bluemask;
+	uint32_t alphamask;
+};
+
+static const struct bmp_pixel_format bmp_bgra8888 = {
+	32, 0x00ff0000U, 0x0000ff00U, 0x000000ffU, 0xff000000U,
+};
+
+static const struct bmp_pixel_format bmp_rgba8888 = {
+	32, 0x000000ffU, 0x0000ff00U, 0x00ff0000U, 0xff000000U,
+};
+
+static const struct bmp_pixel_format bmp_r5g6b5 = {
+	16, 0xf800U, 0x07e0U, 0x001fU, 0x0000U,
+};
+
+static const struct bmp_pixel_format bmp_r5g5b5a1 = {
+	16, 0xf800U, 0x07c0U, 0x003eU, 0x0001U,
+};
+
+static const struct bmp_pixel_format bmp_r4g4b4a4 = {
+	16, 0xf000U, 0x0f00U, 0x00f0U, 0x000fU,
+};
+
+/* large textures are split in bands of rows which are processed in parallel */
+static int split_image(const struct gliden64_file *file)
+{
+	return (uint64_t)file->width * file->height >= globals.split_threshold;
+}
+
+struct flip_job {
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t line_size;
+	size_t stride;
+	size_t height;
+};
+
+static void flip_rows(size_t start, size_t end, void *ctx)
+{
+	const struct flip_job *job = ctx;
+	size_t i;
+
+	for (i = start; i < end; i++) {
+		uint8_t *target_pos = job->dst + i * job->stride;
+		const uint8_t *source_pos = job->src;
+
+		source_pos += (job->height - i - 1) * job->line_size;
+
+		memcpy(target_pos, source_pos, job->line_size);
+		memset(target_pos + job->line_size, 0, job->stride - job->line_size);
 	}
+}
+
+/* BITMAPINFOHEADER followed by an optional palette of colors entries */
+static void bmp_fill_header(struct bmp_header *header,
+			    const struct gliden64_file *file,
+			    uint16_t bitperpixel, uint32_t colors,
+			    uint32_t datasize)
+{
+	uint32_t dataofs = (uint32_t)sizeof(*header) + colors * 4;
 
-	return size;
+	memset(header, 0, sizeof(*header));
+	header->identifier = htole16(0x4d42U);
+	header->filesize = htole32(datasize + dataofs);
+	header->dataofs = htole32(dataofs);
+	header->headersize = htole32((uint32_t)sizeof(*header) - 14);
+	header->width = htole32(file->width);
+	header->height = htole32(file->height);
+	header->planes = htole16(1);
+	header->bitperpixel = htole16(bitperpixel);
+	header->compression = htole32(0);
+	header->datasize = htole32(datasize);
+	header->hresolution = htole32(2835);
+	header->vresolution = htole32(2835);
+	header->colors = htole32(colors);
+	header->importantcolors = htole32(0);
 }
 
-static int resize_image_bmp(struct gliden64_file *file)
+static int resize_image_bmp(struct gliden64_file *file,
+			    const struct bmp_pixel_format *pixfmt)
 {
 	struct bmp_header *header;
 	struct bmp_header_v5 *header_v5;
 	uint32_t header_size;
 	void *buf;
-	uint8_t *imagedata;
-	size_t line_size = file->width * 4;
-	uint32_t i;
+	size_t line_size = (size_t)file->width * (pixfmt->bitperpixel / 8);
+	size_t stride = (line_size + 3) & ~(size_t)3;
+	size_t datasize = stride * file->height;
+	struct flip_job flip;
+	int bitmapv5;
 
-	if (file->format != GR_BGRA) {
-		fprintf(stderr, "Unsupported texture format %#x for bmp export\n", file->format);
-		return -EPERM;
-	}
+	/* only V5 headers can describe other channel layouts than BGRA */
+	bitmapv5 = globals.bitmapv5 || pixfmt != &bmp_bgra8888;
 
-	if (globals.bitmapv5)
+	if (bitmapv5)
 		header_size = (uint32_t)sizeof(*header_v5);
 	else
 		header_size = (uint32_t)sizeof(*header);
 
-	if (file->size > (UINT32_MAX - header_size)) {
+	if (datasize > (UINT32_MAX - header_size) ||
+	    line_size * file->height > file->size) {
 		fprintf(stderr, "Too large texture for bmp export\n");
 		return -EPERM;
 	}
 
-	buf = malloc(file->size + header_size);
+	buf = malloc(datasize + header_size);
 	if (!buf) {
 		fprintf(stderr, "Memory for BMP file couldn't be allocated\n");
 		return -ENOMEM;
 	}
 
-	if (globals.bitmapv5) {
+	if (bitmapv5) {
 		header_v5 = (struct bmp_header_v5 *)buf;
 		memset(header_v5, 0, header_size);
 		header_v5->identifier = htole16(0x4d42U);
-		header_v5->filesize = htole32(file->size + header_size);
+		header_v5->filesize = htole32((uint32_t)datasize + header_size);
 		header_v5->dataofs = htole32(header_size);
 		header_v5->headersize = htole32(header_size - 14);
 		header_v5->width = htole32(file->width);
 		header_v5->height = htole32(file->height);
 		header_v5->planes = htole16(1);
-		header_v5->bitperpixel = htole16(32);
+		header_v5->bitperpixel = htole16(pixfmt->bitperpixel);
 		header_v5->compression = htole32(3);
-		header_v5->datasize = htole32(file->size);
+		header_v5->datasize = htole32((uint32_t)datasize);
 		header_v5->hresolution = htole32(2835);
 		header_v5->vresolution = htole32(2835);
 		header_v5->colors = htole32(0);
 		header_v5->importantcolors = htole32(0);
-		header_v5->redmask = htole32(0x00ff0000U);
-		header_v5->greenmask = htole32(0x0000ff00U);
-		header_v5->bluemask = htole32(0x000000ffU);
-		header_v5->alphamask = htole32(0xff000000U);
+		header_v5->redmask = htole32(pixfmt->redmask);
+		header_v5->greenmask = htole32(pixfmt->greenmask);
+		header_v5->bluemask = htole32(pixfmt->bluemask);
+		header_v5->alphamask = htole32(pixfmt->alphamask);
 		header_v5->colorspace = htole32(0x73524742U);
 		header_v5->ciexyz_red_x = htole32(0x00000000U);
 		header_v5->ciexyz_red_y = htole32(0x00000000U);
@@ -168,61 +282,297 @@ static int resize_image_bmp(struct gliden64_file *file)
 		header_v5->profiledata_size = htole32(4);
 	} else {
 		header = (struct bmp_header *)buf;
-		memset(header, 0, header_size);
-		header->identifier = htole16(0x4d42U);
-		header->filesize = htole32(file->size + header_size);
-		header->dataofs = htole32(header_size);
-		header->headersize = htole32(header_size - 14);
-		header->width = htole32(file->width);
-		header->height = htole32(file->height);
-		header->planes = htole16(1);
-		header->bitperpixel = htole16(32);
-		header->compression = htole32(0);
-		header->datasize = htole32(file->size);
-		header->hresolution = htole32(2835);
-		header->vresolution = htole32(2835);
-		header->colors = htole32(0);
-		header->importantcolors = htole32(0);
-	}
-
-	imagedata = (uint8_t *)buf + header_size;
-	for (i = 0; i < file->height; i++) {
-		uint32_t target_line = i;
-		uint32_t source_line = file->height - i - 1;
-		uint8_t *target_pos = imagedata + target_line * line_size;
-		uint8_t *source_pos = (uint8_t *)file->data;
-
-		source_pos += source_line * line_size;
-
-		memcpy(target_pos, source_pos, line_size);
+		bmp_fill_header(header, file, 32, 0, (uint32_t)datasize);
 	}
+
+	/* pixel data is little endian in the cache and in the bitmap */
+	flip.src = file->data;
+	flip.dst = (uint8_t *)buf + header_size;
+	flip.line_size = line_size;
+	flip.stride = stride;
+	flip.height = file->height;
+
+	if (split_image(file))
+		parallel_for(file->height, flip_rows, &flip);
+	else
+		flip_rows(0, file->height, &flip);
+
 	free(file->data);
 	file->data = buf;
-	file->size += header_size;
+	file->size = (uint32_t)datasize + header_size;
 
 	return 0;
 }
 
-static int normalize_image_r5g6b5(struct gliden64_file *file)
+/* all pixels are checked in blocks so the compiler can vectorize the AND
+ * while translucent textures still stop early
+ */
+static int bmp_image_opaque(const struct gliden64_file *file)
 {
-	uint32_t *buf;
-	uint16_t *data, raw;
-	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, r, g, b;
+	const uint32_t *data = file->data;
+	size_t pixels = (size_t)file->width * file->height;
+	size_t pos, end, i;
+	uint32_t acc;
 
-	pixels = file->width * file->height;
-	newsize = pixels * 4;
-	if (newsize > UINT32_MAX)
-		return -EINVAL;
+	for (pos = 0; pos < pixels; pos = end) {
+		end = pos + 1024;
+		if (end > pixels)
+			end = pixels;
 
-	buf = malloc(newsize);
+		acc = 0xffffffffU;
+		for (i = pos; i < end; i++)
+			acc &= data[i];
+
+		if ((le32toh(acc) >> 24) != 0xffU)
+			return 0;
+	}
+
+	return 1;
+}
+
+#define BMP_PALETTE_COLORS 256
+#define BMP_PALETTE_HASH_SIZE 1024
+
+/* returns the number of colors or 0 when there are too many for a palette.
+ * Colors are numbered in order of their first appearance
+ */
+static uint32_t bmp_image_palette(const struct gliden64_file *file,
+				  uint32_t *palette, uint8_t *indices)
+{
+	const uint32_t *data = file->data;
+	size_t pixels = (size_t)file->width * file->height;
+	uint32_t hash_colors[BMP_PALETTE_HASH_SIZE];
+	int16_t hash_indices[BMP_PALETTE_HASH_SIZE];
+	uint32_t colors = 0;
+	uint32_t last = 0;
+	uint32_t color;
+	uint8_t last_index = 0;
+	size_t pos, slot;
+
+	memset(hash_indices, 0xff, sizeof(hash_indices));
+
+	for (pos = 0; pos < pixels; pos++) {
+		color = data[pos];
+		if (pos > 0 && color == last) {
+			indices[pos] = last_index;
+			continue;
+		}
+
+		slot = (color * 0x9e3779b1U) >> 22;
+		while (hash_indices[slot] >= 0 && hash_colors[slot] != color)
+			slot = (slot + 1) % BMP_PALETTE_HASH_SIZE;
+
+		if (hash_indices[slot] < 0) {
+			if (colors == BMP_PALETTE_COLORS)
+				return 0;
+
+			hash_colors[slot] = color;
+			hash_indices[slot] = (int16_t)colors;
+			palette[colors++] = color;
+		}
+
+		last = color;
+		last_index = (uint8_t)hash_indices[slot];
+		indices[pos] = last_index;
+	}
+
+	return colors;
+}
+
+struct pack_job {
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t width;
+	size_t stride;
+	size_t height;
+};
+
+static void pack_rows_bgr(size_t start, size_t end, void *ctx)
+{
+	const struct pack_job *job = ctx;
+	size_t i, x;
+
+	for (i = start; i < end; i++) {
+		uint8_t *target_pos = job->dst + i * job->stride;
+		const uint8_t *source_pos = job->src;
+
+		source_pos += (job->height - i - 1) * job->width * 4;
+
+		for (x = 0; x < job->width; x++) {
+			target_pos[x * 3 + 0] = source_pos[x * 4 + 0];
+			target_pos[x * 3 + 1] = source_pos[x * 4 + 1];
+			target_pos[x * 3 + 2] = source_pos[x * 4 + 2];
+		}
+		memset(target_pos + job->width * 3, 0, job->stride - job->width * 3);
+	}
+}
+
+/* opaque BGRA textures are written with 8 bit palette indices or as 24 bit
+ * BGR. Both decode to the same pixels as the 32 bit BMP
+ */
+static int resize_image_bmp_adaptive(struct gliden64_file *file)
+{
+	uint32_t palette[BMP_PALETTE_COLORS];
+	struct bmp_header *header;
+	struct flip_job flip;
+	struct pack_job pack;
+	uint8_t *indices;
+	uint8_t *buf;
+	size_t pixels = (size_t)file->width * file->height;
+	size_t stride, stride8, stride24, datasize, dataofs;
+	uint32_t colors, i;
+
+	if (pixels * 4 > file->size || !bmp_image_opaque(file))
+		return resize_image_bmp(file, &bmp_bgra8888);
+
+	indices = malloc(pixels);
+	if (!indices) {
+		fprintf(stderr, "Memory for palette indices couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	colors = bmp_image_palette(file, palette, indices);
+	stride8 = ((size_t)file->width + 3) & ~(size_t)3;
+	stride24 = ((size_t)file->width * 3 + 3) & ~(size_t)3;
+
+	/* the palette of small textures can cost more than the 8 bit indices save */
+	if (colors && colors * 4 + stride8 * file->height >= stride24 * file->height)
+		colors = 0;
+
+	stride = colors ? stride8 : stride24;
+
+	datasize = stride * file->height;
+	dataofs = sizeof(*header) + colors * 4;
+	if (datasize > UINT32_MAX - dataofs) {
+		free(indices);
+		fprintf(stderr, "Too large texture for bmp export\n");
+		return -EPERM;
+	}
+
+	buf = malloc(dataofs + datasize);
 	if (!buf) {
-		fprintf(stderr, "Memory for R5G6B5 image content couldn't be allocated\n");
+		free(indices);
+		fprintf(stderr, "Memory for BMP file couldn't be allocated\n");
 		return -ENOMEM;
 	}
 
-	data = (uint16_t *)file->data;
+	header = (struct bmp_header *)buf;
+	bmp_fill_header(header, file, colors ? 8 : 24, colors, (uint32_t)datasize);
+
+	if (colors) {
+		/* palette entries are BGR0, the cache colors are BGRA with a = 0xff */
+		for (i = 0; i < colors; i++)
+			palette[i] = htole32(le32toh(palette[i]) & 0x00ffffffU);
+		memcpy(buf + sizeof(*header), palette, colors * 4);
+
+		flip.src = indices;
+		flip.dst = buf + dataofs;
+		flip.line_size = file->width;
+		flip.stride = stride;
+		flip.height = file->height;
+
+		if (split_image(file))
+			parallel_for(file->height, flip_rows, &flip);
+		else
+			flip_rows(0, file->height, &flip);
+	} else {
+		pack.src = file->data;
+		pack.dst = buf + dataofs;
+		pack.width = file->width;
+		pack.stride = stride;
+		pack.height = file->height;
+
+		if (split_image(file))
+			parallel_for(file->height, pack_rows_bgr, &pack);
+		else
+			pack_rows_bgr(0, file->height, &pack);
+	}
+
+	free(indices);
+	free(file->data);
+	file->data = buf;
+	file->size = (uint32_t)(dataofs + datasize);
+
+	return 0;
+}
+
+typedef void (*convert_pixels_fn)(const void *src, uint32_t *dst, size_t pixels);
+
+static void convert_r5g6b5(const void *src, uint32_t *dst, size_t pixels);
+static void convert_r5g5b5a1(const void *src, uint32_t *dst, size_t pixels);
+static void convert_r4g4b4a4(const void *src, uint32_t *dst, size_t pixels);
+static void convert_lut_r5g6b5(const void *src, uint32_t *dst, size_t pixels);
+static void convert_lut_r5g5b5a1(const void *src, uint32_t *dst, size_t pixels);
+static void convert_lut_r4g4b4a4(const void *src, uint32_t *dst, size_t pixels);
+
+enum conversion_kernel_index {
+	KERNEL_R5G6B5,
+	KERNEL_R5G5B5A1,
+	KERNEL_R4G4B4A4,
+};
+
+/* 16 bit formats are expanded either by bit operations or with a table of
+ * all 65536 BGRA results. conversion_init() picks one of them
+ */
+static struct conversion_kernel {
+	const char *name;
+	convert_pixels_fn scalar;
+	convert_pixels_fn lut;
+	uint32_t *table;
+	convert_pixels_fn convert;
+} conversion_kernels[] = {
+	[KERNEL_R5G6B5] = {
+		"R5G6B5", convert_r5g6b5, convert_lut_r5g6b5, NULL, convert_r5g6b5,
+	},
+	[KERNEL_R5G5B5A1] = {
+		"R5G5B5A1", convert_r5g5b5a1, convert_lut_r5g5b5a1, NULL, convert_r5g5b5a1,
+	},
+	[KERNEL_R4G4B4A4] = {
+		"R4G4B4A4", convert_r4g4b4a4, convert_lut_r4g4b4a4, NULL, convert_r4g4b4a4,
+	},
+};
+
+struct convert_job {
+	const uint8_t *src;
+	uint32_t *dst;
+	size_t src_line_size;
+	size_t width;
+	convert_pixels_fn convert;
+};
+
+static void convert_rows(size_t start, size_t end, void *ctx)
+{
+	const struct convert_job *job = ctx;
+
+	job->convert(job->src + start * job->src_line_size,
+		     job->dst + start * job->width,
+		     (end - start) * job->width);
+}
+
+static void convert_image(const struct gliden64_file *file, uint32_t *dst,
+			  size_t bytes_per_pixel, convert_pixels_fn convert)
+{
+	struct convert_job job;
+
+	job.src = file->data;
+	job.dst = dst;
+	job.src_line_size = file->width * bytes_per_pixel;
+	job.width = file->width;
+	job.convert = convert;
+
+	if (split_image(file))
+		parallel_for(file->height, convert_rows, &job);
+	else
+		convert_rows(0, file->height, &job);
+}
+
+static void convert_r5g6b5(const void *src, uint32_t *dst, size_t pixels)
+{
+	const uint16_t *data = src;
+	uint16_t raw;
+	size_t pos;
+	uint32_t p, r, g, b;
+
 	for (pos = 0; pos < pixels; pos++) {
 		raw = le16toh(data[pos]);
 		r = (raw & 0xf800U) >> 8;
@@ -232,24 +582,15 @@ static int normalize_image_r5g6b5(struct gliden64_file *file)
 		b = (raw & 0x001fU) << 3;
 		b |= b >> 5;
 		p = (0xffU << 24) | (r << 16) | (g << 8) | b;
-		buf[pos] = htole32(p);
+		dst[pos] = htole32(p);
 	}
-
-	free(file->data);
-	file->data = (uint8_t *)buf;
-	file->size = (uint32_t)newsize;
-	file->format = GR_BGRA;
-
-	return 0;
 }
 
-static int normalize_image_r5g5b5a1(struct gliden64_file *file)
+static int normalize_image_r5g6b5(struct gliden64_file *file)
 {
 	uint32_t *buf;
-	uint16_t *data, raw;
 	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, a, r, g, b;
+	size_t pixels;
 
 	pixels = file->width * file->height;
 	newsize = pixels * 4;
@@ -258,11 +599,27 @@ static int normalize_image_r5g5b5a1(struct gliden64_file *file)
 
 	buf = malloc(newsize);
 	if (!buf) {
-		fprintf(stderr, "Memory for R5G5B5A1 image content couldn't be allocated\n");
+		fprintf(stderr, "Memory for R5G6B5 image content couldn't be allocated\n");
 		return -ENOMEM;
 	}
 
-	data = (uint16_t *)file->data;
+	convert_image(file, buf, 2, conversion_kernels[KERNEL_R5G6B5].convert);
+
+	free(file->data);
+	file->data = (uint8_t *)buf;
+	file->size = (uint32_t)newsize;
+	file->format = GR_BGRA;
+
+	return 0;
+}
+
+static void convert_r5g5b5a1(const void *src, uint32_t *dst, size_t pixels)
+{
+	const uint16_t *data = src;
+	uint16_t raw;
+	size_t pos;
+	uint32_t p, a, r, g, b;
+
 	for (pos = 0; pos < pixels; pos++) {
 		raw = le16toh(data[pos]);
 		r = (raw & 0xf800U) >> 8;
@@ -274,24 +631,15 @@ static int normalize_image_r5g5b5a1(struct gliden64_file *file)
 		a = (raw & 0x0001U);
 		a *= 0xffU;
 		p = (a << 24) | (r << 16) | (g << 8) | b;
-		buf[pos] = htole32(p);
+		dst[pos] = htole32(p);
 	}
-
-	free(file->data);
-	file->data = (uint8_t *)buf;
-	file->size = (uint32_t)newsize;
-	file->format = GR_BGRA;
-
-	return 0;
 }
 
-static int normalize_image_r4g4b4a4(struct gliden64_file *file)
+static int normalize_image_r5g5b5a1(struct gliden64_file *file)
 {
 	uint32_t *buf;
-	uint16_t *data, raw;
 	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, a, r, g, b;
+	size_t pixels;
 
 	pixels = file->width * file->height;
 	newsize = pixels * 4;
@@ -300,14 +648,30 @@ static int normalize_image_r4g4b4a4(struct gliden64_file *file)
 
 	buf = malloc(newsize);
 	if (!buf) {
-		fprintf(stderr, "Memory for R4G4B4A4 image content couldn't be allocated\n");
+		fprintf(stderr, "Memory for R5G5B5A1 image content couldn't be allocated\n");
 		return -ENOMEM;
 	}
 
-	data = (uint16_t *)file->data;
+	convert_image(file, buf, 2, conversion_kernels[KERNEL_R5G5B5A1].convert);
+
+	free(file->data);
+	file->data = (uint8_t *)buf;
+	file->size = (uint32_t)newsize;
+	file->format = GR_BGRA;
+
+	return 0;
+}
+
+static void convert_r4g4b4a4(const void *src, uint32_t *dst, size_t pixels)
+{
+	const uint16_t *data = src;
+	uint16_t raw;
+	size_t pos;
+	uint32_t p, a, r, g, b;
+
 	for (pos = 0; pos < pixels; pos++) {
 		raw = le16toh(data[pos]);
-		r = (raw & 0xf000U) >> 4;
+		r = (raw & 0xf000U) >> 8;
 		r |= r >> 4;
 		g = (raw & 0x0f00U) >> 4;
 		g |= g >> 4;
@@ -316,8 +680,28 @@ static int normalize_image_r4g4b4a4(struct gliden64_file *file)
 		a = (raw & 0x000fU) << 4;
 		a |= a >> 4;
 		p = (a << 24) | (r << 16) | (g << 8) | b;
-		buf[pos] = htole32(p);
+		dst[pos] = htole32(p);
 	}
+}
+
+static int normalize_image_r4g4b4a4(struct gliden64_file *file)
+{
+	uint32_t *buf;
+	size_t newsize;
+	size_t pixels;
+
+	pixels = file->width * file->height;
+	newsize = pixels * 4;
+	if (newsize > UINT32_MAX)
+		return -EINVAL;
+
+	buf = malloc(newsize);
+	if (!buf) {
+		fprintf(stderr, "Memory for R4G4B4A4 image content couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	convert_image(file, buf, 2, conversion_kernels[KERNEL_R4G4B4A4].convert);
 
 	free(file->data);
 	file->data = (uint8_t *)buf;
@@ -327,15 +711,195 @@ static int normalize_image_r4g4b4a4(struct gliden64_file *file)
 	return 0;
 }
 
-static int normalize_image_r8g8b8a8(struct gliden64_file *file)
+static inline void convert_lut(const uint32_t *table, const void *src,
+			       uint32_t *dst, size_t pixels)
 {
-	uint32_t *data, raw;
-	size_t pixels, pos;
-	uint32_t p, a, r, g, b;
+	const uint16_t *data = src;
+	size_t pos;
 
-	pixels = file->width * file->height;
+	for (pos = 0; pos < pixels; pos++)
+		dst[pos] = table[le16toh(data[pos])];
+}
+
+static void convert_lut_r5g6b5(const void *src, uint32_t *dst, size_t pixels)
+{
+	convert_lut(conversion_kernels[KERNEL_R5G6B5].table, src, dst, pixels);
+}
+
+static void convert_lut_r5g5b5a1(const void *src, uint32_t *dst, size_t pixels)
+{
+	convert_lut(conversion_kernels[KERNEL_R5G5B5A1].table, src, dst, pixels);
+}
+
+static void convert_lut_r4g4b4a4(const void *src, uint32_t *dst, size_t pixels)
+{
+	convert_lut(conversion_kernels[KERNEL_R4G4B4A4].table, src, dst, pixels);
+}
+
+#define CONVERSION_TABLE_SIZE 65536
+#define CONVERSION_SAMPLE_PIXELS (16 * 1024)
+#define CONVERSION_SAMPLE_RUNS 3
+
+static uint64_t conversion_time(convert_pixels_fn convert, const uint16_t *src,
+				uint32_t *dst)
+{
+	struct timespec start, end;
+	uint64_t best = UINT64_MAX;
+	uint64_t duration;
+	unsigned int i;
+
+	for (i = 0; i < CONVERSION_SAMPLE_RUNS; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		convert(src, dst, CONVERSION_SAMPLE_PIXELS);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		duration = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL;
+		duration += (uint64_t)end.tv_nsec;
+		duration -= (uint64_t)start.tv_nsec;
+		if (duration < best)
+			best = duration;
+	}
+
+	return best;
+}
+
+/* texture like sample: runs of similar colors with noise in the low bits */
+static void conversion_sample(uint16_t *sample)
+{
+	uint32_t state = 0x12345678U;
+	uint16_t color = 0;
+	size_t i;
+
+	for (i = 0; i < CONVERSION_SAMPLE_PIXELS; i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		if ((state & 0xf) == 0)
+			color = (uint16_t)(state >> 16);
+
+		sample[i] = htole16(color ^ (uint16_t)((state >> 8) & 0x0421U));
+	}
+}
+
+/* the table holds the results of the scalar kernel for every input */
+static int conversion_build_table(struct conversion_kernel *kernel)
+{
+	uint16_t *inputs;
+	uint32_t i;
+
+	kernel->table = malloc(CONVERSION_TABLE_SIZE * sizeof(*kernel->table));
+	inputs = malloc(CONVERSION_TABLE_SIZE * sizeof(*inputs));
+	if (!kernel->table || !inputs) {
+		free(kernel->table);
+		free(inputs);
+		kernel->table = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < CONVERSION_TABLE_SIZE; i++)
+		inputs[i] = htole16((uint16_t)i);
+
+	kernel->scalar(inputs, kernel->table, CONVERSION_TABLE_SIZE);
+	free(inputs);
+
+	return 0;
+}
+
+int conversion_init(void)
+{
+	struct conversion_kernel *kernel;
+	uint64_t scalar_time, lut_time;
+	uint16_t *sample = NULL;
+	uint32_t *output = NULL;
+	size_t i;
+	int ret = 0;
+
+	/* nothing is converted when only the cache is checked */
+	if (globals.conversion == CONVERSION_SCALAR || globals.verify || globals.report)
+		return 0;
+
+	/* native BMPs are written without the conversion to BGRA */
+	if (globals.native && !globals.thumbnail_width &&
+	    globals.image_format == IMAGE_BMP)
+		return 0;
+
+	/* the tables stay allocated for the whole run */
+	if (budget_reserve_static(sizeof(conversion_kernels) / sizeof(conversion_kernels[0]) *
+				  CONVERSION_TABLE_SIZE * sizeof(uint32_t)) < 0) {
+		fprintf(stderr, "Conversion tables don't fit into the memory budget\n");
+		return 0;
+	}
+
+	if (globals.conversion == CONVERSION_AUTO) {
+		sample = malloc(CONVERSION_SAMPLE_PIXELS * sizeof(*sample));
+		output = malloc(CONVERSION_SAMPLE_PIXELS * sizeof(*output));
+		if (!sample || !output) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		conversion_sample(sample);
+	}
+
+	for (i = 0; i < sizeof(conversion_kernels) / sizeof(conversion_kernels[0]); i++) {
+		kernel = &conversion_kernels[i];
+
+		ret = conversion_build_table(kernel);
+		if (ret < 0)
+			goto out;
+
+		if (globals.conversion == CONVERSION_LUT) {
+			kernel->convert = kernel->lut;
+			if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+				fprintf(stderr, "%s conversion: table (selected by --conversion)\n",
+					kernel->name);
+			continue;
+		}
+
+		/* warm up caches and the table before measuring */
+		kernel->lut(sample, output, CONVERSION_SAMPLE_PIXELS);
+		scalar_time = conversion_time(kernel->scalar, sample, output);
+		lut_time = conversion_time(kernel->lut, sample, output);
+
+		if (lut_time < scalar_time) {
+			kernel->convert = kernel->lut;
+		} else {
+			free(kernel->table);
+			kernel->table = NULL;
+		}
+
+		if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+			fprintf(stderr, "%s conversion: %s (scalar %"PRIu64" us, table %"PRIu64" us per %u pixels)\n",
+				kernel->name,
+				kernel->convert == kernel->lut ? "table" : "scalar",
+				scalar_time / 1000, lut_time / 1000,
+				CONVERSION_SAMPLE_PIXELS);
+	}
+
+out:
+	free(sample);
+	free(output);
+
+	/* only the tables which are used stay in the budget */
+	for (i = 0; i < sizeof(conversion_kernels) / sizeof(conversion_kernels[0]); i++) {
+		if (!conversion_kernels[i].table)
+			budget_release_static(CONVERSION_TABLE_SIZE * sizeof(uint32_t));
+	}
+
+	if (ret < 0)
+		fprintf(stderr, "Memory for conversion tables couldn't be allocated\n");
+
+	return ret;
+}
+
+static void convert_r8g8b8a8(const void *src, uint32_t *dst, size_t pixels)
+{
+	const uint32_t *data = src;
+	uint32_t raw;
+	size_t pos;
+	uint32_t p, a, r, g, b;
 
-	data = (uint32_t *)file->data;
 	for (pos = 0; pos < pixels; pos++) {
 		raw = le32toh(data[pos]);
 		a = (raw & 0xff000000U) >> 24;
@@ -343,15 +907,38 @@ static int normalize_image_r8g8b8a8(struct gliden64_file *file)
 		g = (raw & 0x0000ff00U) >>  8;
 		r = (raw & 0x000000ffU) >>  0;
 		p = (a << 24) | (r << 16) | (g << 8) | b;
-		data[pos] = htole32(p);
+		dst[pos] = htole32(p);
 	}
+}
+
+static int normalize_image_r8g8b8a8(struct gliden64_file *file)
+{
+	/* conversion is done in place */
+	convert_image(file, (uint32_t *)file->data, 4, convert_r8g8b8a8);
 
 	file->format = GR_BGRA;
 
 	return 0;
 }
 
-static int resize_image_content(struct gliden64_file *file)
+static int resize_image_native(struct gliden64_file *file)
+{
+	switch (file->format) {
+	case GR_RGB:
+		return resize_image_bmp(file, &bmp_r5g6b5);
+	case GR_RGB5_A1:
+		return resize_image_bmp(file, &bmp_r5g5b5a1);
+	case GR_RGBA4:
+		return resize_image_bmp(file, &bmp_r4g4b4a4);
+	case GR_RGBA8:
+		return resize_image_bmp(file, &bmp_rgba8888);
+	default:
+		fprintf(stderr, "Unsupported format %x\n", file->format);
+		return -EPERM;
+	}
+}
+
+static int normalize_image_format(struct gliden64_file *file)
 {
 	int ret;
 
@@ -363,7 +950,7 @@ static int resize_image_content(struct gliden64_file *file)
 			return ret;
 		}
 
-		return resize_image_bmp(file);
+		return 0;
 	case GR_RGB5_A1:
 		ret = normalize_image_r5g5b5a1(file);
 		if (ret < 0) {
@@ -371,7 +958,7 @@ static int resize_image_content(struct gliden64_file *file)
 			return ret;
 		}
 
-		return resize_image_bmp(file);
+		return 0;
 	case GR_RGBA4:
 		ret = normalize_image_r4g4b4a4(file);
 		if (ret < 0) {
@@ -379,7 +966,7 @@ static int resize_image_content(struct gliden64_file *file)
 			return ret;
 		}
 
-		return resize_image_bmp(file);
+		return 0;
 	case GR_RGBA8:
 		ret = normalize_image_r8g8b8a8(file);
 		if (ret < 0) {
@@ -387,7 +974,7 @@ static int resize_image_content(struct gliden64_file *file)
 			return ret;
 		}
 
-		return resize_image_bmp(file);
+		return 0;
 	default:
 		fprintf(stderr, "Unsupported format %x\n", file->format);
 		return -EPERM;
@@ -396,9 +983,66 @@ static int resize_image_content(struct gliden64_file *file)
 	return 0;
 }
 
-int prepare_file(struct gliden64_file *file)
+int normalize_image(struct gliden64_file *file)
+{
+	int ret;
+
+	PROBE4(normalize__start, file->checksum, file->format, file->width, file->height);
+	ret = normalize_image_format(file);
+	PROBE4(normalize__done, file->checksum, file->format, file->size, ret);
+
+	return ret;
+}
+
+int encode_image(struct gliden64_file *file)
 {
-	size_t expected_size;
+	switch (globals.image_format) {
+	case IMAGE_DDS:
+		return dds_encode(file);
+	case IMAGE_BMP:
+	default:
+		if (globals.adaptive)
+			return resize_image_bmp_adaptive(file);
+
+		return resize_image_bmp(file, &bmp_bgra8888);
+	}
+}
+
+static int resize_image_content(struct gliden64_file *file)
+{
+	int ret;
+
+	/* thumbnails and DDS files are always created from BGRA */
+	if (globals.native && !globals.thumbnail_width &&
+	    globals.image_format == IMAGE_BMP)
+		return resize_image_native(file);
+
+	ret = normalize_image(file);
+	if (ret < 0)
+		return ret;
+
+	if (globals.thumbnail_width) {
+		ret = thumbnail_resize(file);
+		if (ret < 0) {
+			fprintf(stderr, "Error during thumbnail generation\n");
+			return ret;
+		}
+
+		/* atlas cells are encoded together in atlas_add() */
+		if (globals.atlas_columns)
+			return 0;
+	}
+
+	/* consumers of the memfd output use the BGRA pixels directly */
+	if (globals.output_format == OUTPUT_MEMFD)
+		return 0;
+
+	return encode_image(file);
+}
+
+int decompress_file(struct gliden64_file *file)
+{
+	uint64_t expected_size;
 	void *buf;
 	uLongf destLen;
 	int ret;
@@ -407,15 +1051,19 @@ int prepare_file(struct gliden64_file *file)
 	if (expected_size > UINT32_MAX)
 		return -EINVAL;
 
+	file->source_format = file->format & ~GR_TEXFMT_GZ;
+
 	if (file->format & GR_TEXFMT_GZ) {
-		destLen = expected_size + 4096;
+		destLen = (uLongf)expected_size + 4096;
 		buf = malloc(destLen);
 		if (!buf) {
 			fprintf(stderr, "Memory for uncompressing the file couldn't be allocated\n");
 			return -ENOMEM;
 		}
 
+		PROBE3(decompress__start, file->checksum, file->format, file->size);
 		ret = uncompress(buf, &destLen, file->data, file->size);
+		PROBE3(decompress__done, file->checksum, destLen, ret);
 		if (ret != Z_OK) {
 			free(buf);
 			fprintf(stderr, "Failure during decompressing\n");
@@ -428,6 +1076,7 @@ int prepare_file(struct gliden64_file *file)
 			return -EINVAL;
 		}
 
+		progress_decompressed(file->size, destLen);
 		file->format &= ~GR_TEXFMT_GZ;
 		free(file->data);
 		file->data = buf;
@@ -439,6 +1088,88 @@ int prepare_file(struct gliden64_file *file)
 		}
 	}
 
+	return 0;
+}
+
+/* runs the checks of decompress_file() without keeping the content, the
+ * inflated data only passes through a small scratch buffer
+ */
+int verify_file(const struct gliden64_file *file, const char **error)
+{
+	uint8_t scratch[64 * 1024];
+	uint64_t expected_size;
+	uint64_t total = 0;
+	z_stream strm;
+	int ret;
+
+	if (!texture_bytes_per_pixel(file->format)) {
+		*error = "unsupported format";
+		return -EINVAL;
+	}
+
+	expected_size = image_content_length(file);
+	if (expected_size > UINT32_MAX) {
+		*error = "image too large";
+		return -EINVAL;
+	}
+
+	if (!(file->format & GR_TEXFMT_GZ)) {
+		if (expected_size != file->size) {
+			*error = "size doesn't match the dimensions";
+			return -EINVAL;
+		}
+
+		return 0;
+	}
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit(&strm) != Z_OK) {
+		*error = "decompressor couldn't be initialized";
+		return -ENOMEM;
+	}
+
+	strm.next_in = file->data;
+	strm.avail_in = file->size;
+	do {
+		strm.next_out = scratch;
+		strm.avail_out = sizeof(scratch);
+		ret = inflate(&strm, Z_NO_FLUSH);
+		total += sizeof(scratch) - strm.avail_out;
+	} while (ret == Z_OK && total <= expected_size);
+
+	inflateEnd(&strm);
+
+	if (total > expected_size) {
+		*error = "decompressed data larger than the dimensions";
+		return -EINVAL;
+	}
+
+	if (ret == Z_BUF_ERROR && strm.avail_in == 0) {
+		*error = "compressed data truncated";
+		return -EINVAL;
+	}
+
+	if (ret != Z_STREAM_END) {
+		*error = "compressed data corrupt";
+		return -EINVAL;
+	}
+
+	if (total != expected_size) {
+		*error = "decompressed size doesn't match the dimensions";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int prepare_file(struct gliden64_file *file)
+{
+	int ret;
+
+	ret = decompress_file(file);
+	if (ret < 0)
+		return ret;
+
 	ret = resize_image_content(file);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to prepare image content\n");
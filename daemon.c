@@ -0,0 +1,623 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * Requests are single lines on the unix socket:
+ *
+ *   GET <checksum in hex> [image|raw]
+ *
+ * "image" (default) returns the texture encoded like in the tar output,
+ * "raw" returns the top-down BGRA_8888 pixels. The answer is either
+ *
+ *   OK <checksum> <width> <height> <source format> <size>
+ *
+ * followed by size bytes of data or "ERR <reason>".
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __WIN32__
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum daemon_kind {
+	DAEMON_IMAGE = 0,
+	DAEMON_RAW,
+	DAEMON_KINDS,
+};
+
+struct daemon_decoded;
+
+struct daemon_entry {
+	struct gliden64_file header;
+	uint64_t offset;
+	unsigned int cache;
+	struct daemon_decoded *decoded[DAEMON_KINDS];
+};
+
+struct daemon_decoded {
+	struct daemon_decoded *prev;
+	struct daemon_decoded *next;
+	struct daemon_entry *entry;
+	enum daemon_kind kind;
+	unsigned int refs;
+	int cached;
+	struct gliden64_file file;
+};
+
+static struct {
+	int *fds;
+	unsigned int caches;
+	struct daemon_entry *entries;
+	size_t count;
+	size_t capacity;
+
+	/* protects the LRU list and the decoded pointers of the entries */
+	pthread_mutex_t lock;
+	struct daemon_decoded *head;
+	struct daemon_decoded *tail;
+	uint64_t cached_bytes;
+} daemon_state = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int daemon_compare_entry(const void *a, const void *b)
+{
+	const struct daemon_entry *entry_a = a;
+	const struct daemon_entry *entry_b = b;
+
+	if (entry_a->header.checksum < entry_b->header.checksum)
+		return -1;
+	if (entry_a->header.checksum > entry_b->header.checksum)
+		return 1;
+
+	/* earlier caches win for duplicated checksums */
+	if (entry_a->cache < entry_b->cache)
+		return -1;
+	if (entry_a->cache > entry_b->cache)
+		return 1;
+
+	if (entry_a->offset < entry_b->offset)
+		return -1;
+	if (entry_a->offset > entry_b->offset)
+		return 1;
+
+	return 0;
+}
+
+static int daemon_add_entry(const struct gliden64_file *file, uint64_t offset,
+			    unsigned int cache)
+{
+	struct daemon_entry *entries;
+	struct daemon_entry *entry;
+
+	if (daemon_state.count == daemon_state.capacity) {
+		daemon_state.capacity = daemon_state.capacity ? daemon_state.capacity * 2 : 1024;
+		entries = realloc(daemon_state.entries,
+				  daemon_state.capacity * sizeof(*entries));
+		if (!entries)
+			return -ENOMEM;
+		daemon_state.entries = entries;
+	}
+
+	entry = &daemon_state.entries[daemon_state.count++];
+	memset(entry, 0, sizeof(*entry));
+	entry->header = *file;
+	entry->header.data = NULL;
+	entry->offset = offset;
+	entry->cache = cache;
+
+	return 0;
+}
+
+/* walks over the file headers and skips the contents */
+static int daemon_index_cache(const char *path, unsigned int cache)
+{
+	struct gliden64_file file;
+	uint32_t config;
+	long pos;
+	int ret;
+
+	globals.in = fopen(path, "rb");
+	if (!globals.in) {
+		fprintf(stderr, "Could not open input file %s\n", path);
+		return -ENOENT;
+	}
+
+	daemon_state.fds[cache] = fileno(globals.in);
+
+	ret = get_item(config);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to read config header of %s\n", path);
+		return ret;
+	}
+
+	if (config & FILE_CACHE_MASK) {
+		fprintf(stderr, "TexStream format of %s not supported\n", path);
+		return -EINVAL;
+	}
+
+	for (;;) {
+		ret = read_file_header(&file);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to index %s\n", path);
+			return ret;
+		}
+
+		if (ret > 0)
+			break;
+
+		pos = input_tell();
+		if (pos < 0)
+			return -EIO;
+
+		if (filter_match(&file)) {
+			ret = daemon_add_entry(&file, (uint64_t)pos, cache);
+			if (ret < 0)
+				return ret;
+		}
+
+		ret = input_skip(file.size, 1);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to index %s\n", path);
+			return ret;
+		}
+	}
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Indexed %s\n", path);
+
+	return 0;
+}
+
+static int daemon_index(char *paths[], unsigned int count)
+{
+	size_t i, unique = 0;
+	unsigned int cache;
+	int ret;
+
+	daemon_state.fds = calloc(count, sizeof(*daemon_state.fds));
+	if (!daemon_state.fds)
+		return -ENOMEM;
+
+	daemon_state.caches = count;
+	for (cache = 0; cache < count; cache++) {
+		ret = daemon_index_cache(paths[cache], cache);
+		if (ret < 0)
+			return ret;
+	}
+
+	qsort(daemon_state.entries, daemon_state.count,
+	      sizeof(*daemon_state.entries), daemon_compare_entry);
+
+	for (i = 0; i < daemon_state.count; i++) {
+		if (unique &&
+		    daemon_state.entries[unique - 1].header.checksum == daemon_state.entries[i].header.checksum)
+			continue;
+
+		daemon_state.entries[unique++] = daemon_state.entries[i];
+	}
+	daemon_state.count = unique;
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "%zu textures available\n", daemon_state.count);
+
+	return 0;
+}
+
+static struct daemon_entry *daemon_find(uint64_t checksum)
+{
+	size_t low = 0, high = daemon_state.count, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (daemon_state.entries[mid].header.checksum < checksum)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == daemon_state.count ||
+	    daemon_state.entries[low].header.checksum != checksum)
+		return NULL;
+
+	return &daemon_state.entries[low];
+}
+
+/* must be called with daemon_state.lock held */
+static void daemon_lru_unlink(struct daemon_decoded *decoded)
+{
+	if (decoded->prev)
+		decoded->prev->next = decoded->next;
+	else
+		daemon_state.head = decoded->next;
+
+	if (decoded->next)
+		decoded->next->prev = decoded->prev;
+	else
+		daemon_state.tail = decoded->prev;
+
+	decoded->prev = NULL;
+	decoded->next = NULL;
+}
+
+/* must be called with daemon_state.lock held */
+static void daemon_lru_push(struct daemon_decoded *decoded)
+{
+	decoded->prev = NULL;
+	decoded->next = daemon_state.head;
+	if (daemon_state.head)
+		daemon_state.head->prev = decoded;
+	else
+		daemon_state.tail = decoded;
+	daemon_state.head = decoded;
+}
+
+static void daemon_free_decoded(struct daemon_decoded *decoded)
+{
+	free(decoded->file.data);
+	free(decoded);
+}
+
+/* must be called with daemon_state.lock held - entries which are still
+ * sent to a client are freed by the last daemon_put()
+ */
+static void daemon_evict(void)
+{
+	struct daemon_decoded *victim;
+
+	while (daemon_state.cached_bytes > globals.daemon_cache_size &&
+	       daemon_state.tail) {
+		victim = daemon_state.tail;
+		daemon_lru_unlink(victim);
+		victim->entry->decoded[victim->kind] = NULL;
+		victim->cached = 0;
+		daemon_state.cached_bytes -= victim->file.size;
+
+		if (victim->refs == 0)
+			daemon_free_decoded(victim);
+	}
+}
+
+static void daemon_put(struct daemon_decoded *decoded)
+{
+	int release;
+
+	pthread_mutex_lock(&daemon_state.lock);
+	decoded->refs--;
+	release = decoded->refs == 0 && !decoded->cached;
+	pthread_mutex_unlock(&daemon_state.lock);
+
+	if (release)
+		daemon_free_decoded(decoded);
+}
+
+static int daemon_pread(int fd, void *buffer, size_t size, uint64_t offset)
+{
+	uint8_t *out = buffer;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = pread(fd, out, size, (off_t)offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return -EIO;
+
+		out += ret;
+		offset += (uint64_t)ret;
+		size -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+static int daemon_decode(struct daemon_entry *entry, enum daemon_kind kind,
+			 struct gliden64_file *file)
+{
+	int ret;
+
+	*file = entry->header;
+	file->data = malloc(file->size);
+	if (!file->data)
+		return -ENOMEM;
+
+	ret = daemon_pread(daemon_state.fds[entry->cache], file->data,
+			   file->size, entry->offset);
+	if (ret < 0)
+		goto err;
+
+	switch (kind) {
+	case DAEMON_RAW:
+		ret = decompress_file(file);
+		if (ret < 0)
+			goto err;
+
+		ret = normalize_image(file);
+		break;
+	case DAEMON_IMAGE:
+	default:
+		ret = prepare_file(file);
+		break;
+	}
+
+	if (ret < 0)
+		goto err;
+
+	return 0;
+
+err:
+	free(file->data);
+	file->data = NULL;
+
+	return ret;
+}
+
+/* returns a referenced decoded texture - from the LRU or freshly decoded */
+static int daemon_get(struct daemon_entry *entry, enum daemon_kind kind,
+		      struct daemon_decoded **result)
+{
+	struct daemon_decoded *decoded;
+	int ret;
+
+	pthread_mutex_lock(&daemon_state.lock);
+	decoded = entry->decoded[kind];
+	if (decoded) {
+		decoded->refs++;
+		daemon_lru_unlink(decoded);
+		daemon_lru_push(decoded);
+		pthread_mutex_unlock(&daemon_state.lock);
+
+		*result = decoded;
+		return 0;
+	}
+	pthread_mutex_unlock(&daemon_state.lock);
+
+	decoded = calloc(1, sizeof(*decoded));
+	if (!decoded)
+		return -ENOMEM;
+
+	ret = daemon_decode(entry, kind, &decoded->file);
+	if (ret < 0) {
+		free(decoded);
+		return ret;
+	}
+
+	decoded->entry = entry;
+	decoded->kind = kind;
+	decoded->refs = 1;
+
+	pthread_mutex_lock(&daemon_state.lock);
+	if (entry->decoded[kind]) {
+		/* another connection decoded the same texture in the meantime */
+		daemon_free_decoded(decoded);
+		decoded = entry->decoded[kind];
+		decoded->refs++;
+	} else if (decoded->file.size <= globals.daemon_cache_size) {
+		decoded->cached = 1;
+		entry->decoded[kind] = decoded;
+		daemon_lru_push(decoded);
+		daemon_state.cached_bytes += decoded->file.size;
+		daemon_evict();
+	}
+	pthread_mutex_unlock(&daemon_state.lock);
+
+	*result = decoded;
+
+	return 0;
+}
+
+static int daemon_send(int fd, const void *buffer, size_t size)
+{
+	const uint8_t *data = buffer;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = send(fd, data, size, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0)
+			return -errno;
+
+		data += ret;
+		size -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+static int daemon_send_error(int fd, const char *reason)
+{
+	char line[128];
+	int len;
+
+	len = snprintf(line, sizeof(line), "ERR %s\n", reason);
+	if (len < 0)
+		return -EINVAL;
+
+	return daemon_send(fd, line, (size_t)len);
+}
+
+static int daemon_request(int fd, char *line)
+{
+	struct daemon_decoded *decoded;
+	struct daemon_entry *entry;
+	enum daemon_kind kind = DAEMON_IMAGE;
+	char *command, *checksum_str, *kind_str, *saveptr, *end;
+	uint64_t checksum;
+	char header[128];
+	int len;
+	int ret;
+
+	command = strtok_r(line, " \t\r\n", &saveptr);
+	checksum_str = strtok_r(NULL, " \t\r\n", &saveptr);
+	kind_str = strtok_r(NULL, " \t\r\n", &saveptr);
+
+	if (!command || strcasecmp(command, "GET") != 0 || !checksum_str)
+		return daemon_send_error(fd, "invalid request");
+
+	checksum = strtoull(checksum_str, &end, 16);
+	if (*end != '\0')
+		return daemon_send_error(fd, "invalid checksum");
+
+	if (kind_str) {
+		if (strcasecmp(kind_str, "raw") == 0)
+			kind = DAEMON_RAW;
+		else if (strcasecmp(kind_str, "image") != 0)
+			return daemon_send_error(fd, "invalid type");
+	}
+
+	entry = daemon_find(checksum);
+	if (!entry)
+		return daemon_send_error(fd, "not found");
+
+	ret = daemon_get(entry, kind, &decoded);
+	if (ret < 0)
+		return daemon_send_error(fd, "decoding failed");
+
+	len = snprintf(header, sizeof(header), "OK %016"PRIX64" %"PRIu32" %"PRIu32" %#"PRIx32" %"PRIu32"\n",
+		       checksum, decoded->file.width, decoded->file.height,
+		       decoded->file.source_format, decoded->file.size);
+	if (len < 0)
+		ret = -EINVAL;
+	else
+		ret = daemon_send(fd, header, (size_t)len);
+
+	if (ret == 0)
+		ret = daemon_send(fd, decoded->file.data, decoded->file.size);
+
+	daemon_put(decoded);
+
+	return ret;
+}
+
+static void *daemon_connection(void *arg)
+{
+	int fd = (int)(intptr_t)arg;
+	char *line = NULL;
+	size_t line_size = 0;
+	FILE *in;
+
+	in = fdopen(fd, "r");
+	if (!in) {
+		close(fd);
+		return NULL;
+	}
+
+	while (getline(&line, &line_size, in) > 0) {
+		if (daemon_request(fd, line) < 0)
+			break;
+	}
+
+	free(line);
+	fclose(in);
+
+	return NULL;
+}
+
+static int daemon_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+	int ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return -ENAMETOOLONG;
+	}
+
+	/* only replace stale sockets - never other files */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 64) < 0) {
+		ret = -errno;
+		fprintf(stderr, "Could not listen on %s\n", path);
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+int daemon_run(char *paths[], unsigned int count)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int listen_fd, fd;
+	int ret;
+
+	if (count == 0) {
+		fprintf(stderr, "Daemon needs at least one cache file\n");
+		return -EINVAL;
+	}
+
+	ret = daemon_index(paths, count);
+	if (ret < 0)
+		return ret;
+
+	listen_fd = daemon_listen(globals.daemon_socket);
+	if (listen_fd < 0)
+		return listen_fd;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (;;) {
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			ret = -errno;
+			fprintf(stderr, "Failed to accept connection: %s\n", strerror(errno));
+			break;
+		}
+
+		ret = pthread_create(&thread, &attr, daemon_connection, (void *)(intptr_t)fd);
+		if (ret != 0) {
+			fprintf(stderr, "Failed to start connection thread: %s\n", strerror(ret));
+			close(fd);
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+	close(listen_fd);
+
+	return ret;
+}
+#else
+int daemon_run(char *paths[], unsigned int count)
+{
+	(void)paths;
+	(void)count;
+
+	fprintf(stderr, "Daemon mode is not supported on this platform\n");
+	return -EOPNOTSUPP;
+}
+#endif
@@ -0,0 +1,561 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DDSD_CAPS		0x00000001U
+#define DDSD_HEIGHT		0x00000002U
+#define DDSD_WIDTH		0x00000004U
+#define DDSD_PITCH		0x00000008U
+#define DDSD_PIXELFORMAT	0x00001000U
+#define DDSD_LINEARSIZE		0x00080000U
+
+#define DDPF_ALPHAPIXELS	0x00000001U
+#define DDPF_FOURCC		0x00000004U
+#define DDPF_RGB		0x00000040U
+
+#define DDSCAPS_TEXTURE		0x00001000U
+
+#define DXGI_FORMAT_BC7_UNORM	98
+#define D3D10_RESOURCE_DIMENSION_TEXTURE2D 3
+
+#define FOURCC(a, b, c, d) \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#pragma pack(push, 1)
+struct dds_pixelformat {
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourcc;
+	uint32_t rgbbitcount;
+	uint32_t redmask;
+	uint32_t greenmask;
+	uint32_t bluemask;
+	uint32_t alphamask;
+};
+
+struct dds_header {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitch_or_linear_size;
+	uint32_t depth;
+	uint32_t mipmapcount;
+	uint32_t reserved[11];
+	struct dds_pixelformat pixelformat;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+struct dds_header_dxt10 {
+	uint32_t dxgi_format;
+	uint32_t resource_dimension;
+	uint32_t misc_flag;
+	uint32_t array_size;
+	uint32_t misc_flags2;
+};
+#pragma pack(pop)
+
+struct dds_job {
+	const uint8_t *src;
+	uint8_t *dst;
+	uint32_t width;
+	uint32_t height;
+	uint32_t blocks_x;
+	size_t block_size;
+	enum dds_compression compression;
+};
+
+static const uint8_t bc7_weights4[16] = {
+	0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64,
+};
+
+/* fetch a 4x4 block of RGBA texels, the border is clamped to the edge */
+static void dds_fetch_block(const struct dds_job *job, uint32_t bx, uint32_t by,
+			    uint8_t block[16][4])
+{
+	const uint8_t *pixel;
+	uint32_t x, y, sx, sy;
+
+	for (y = 0; y < 4; y++) {
+		sy = by * 4 + y;
+		if (sy >= job->height)
+			sy = job->height - 1;
+
+		for (x = 0; x < 4; x++) {
+			sx = bx * 4 + x;
+			if (sx >= job->width)
+				sx = job->width - 1;
+
+			/* BGRA input */
+			pixel = &job->src[((size_t)sy * job->width + sx) * 4];
+			block[y * 4 + x][0] = pixel[2];
+			block[y * 4 + x][1] = pixel[1];
+			block[y * 4 + x][2] = pixel[0];
+			block[y * 4 + x][3] = pixel[3];
+		}
+	}
+}
+
+static void dds_put_le16(uint8_t *dst, uint16_t value)
+{
+	dst[0] = (uint8_t)value;
+	dst[1] = (uint8_t)(value >> 8);
+}
+
+static uint16_t bc1_pack565(const uint8_t *color)
+{
+	return (uint16_t)(((color[0] * 31 + 127) / 255) << 11 |
+			  ((color[1] * 63 + 127) / 255) << 5 |
+			  ((color[2] * 31 + 127) / 255));
+}
+
+static void bc1_unpack565(uint16_t packed, uint8_t *color)
+{
+	uint32_t r = (packed >> 11) & 0x1f;
+	uint32_t g = (packed >> 5) & 0x3f;
+	uint32_t b = packed & 0x1f;
+
+	color[0] = (uint8_t)((r << 3) | (r >> 2));
+	color[1] = (uint8_t)((g << 2) | (g >> 4));
+	color[2] = (uint8_t)((b << 3) | (b >> 2));
+}
+
+static uint32_t color_distance(const uint8_t *a, const uint8_t *b, int channels)
+{
+	uint32_t dist = 0;
+	int32_t diff;
+	int i;
+
+	for (i = 0; i < channels; i++) {
+		diff = (int32_t)a[i] - (int32_t)b[i];
+		dist += (uint32_t)(diff * diff);
+	}
+
+	return dist;
+}
+
+/* color block in four color mode - also used as color part of BC3 */
+static void bc1_encode_color(uint8_t block[16][4], uint8_t *dst)
+{
+	uint8_t min[3] = { 255, 255, 255 };
+	uint8_t max[3] = { 0, 0, 0 };
+	uint8_t palette[4][3];
+	uint16_t c0, c1, tmp;
+	uint32_t indices = 0;
+	uint32_t best, dist;
+	uint8_t inset;
+	int i, j, best_index;
+
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 3; j++) {
+			if (block[i][j] < min[j])
+				min[j] = block[i][j];
+			if (block[i][j] > max[j])
+				max[j] = block[i][j];
+		}
+	}
+
+	/* move the endpoints slightly inside the bounding box */
+	for (j = 0; j < 3; j++) {
+		inset = (uint8_t)((max[j] - min[j]) / 16);
+		min[j] = (uint8_t)(min[j] + inset);
+		max[j] = (uint8_t)(max[j] - inset);
+	}
+
+	c0 = bc1_pack565(max);
+	c1 = bc1_pack565(min);
+	if (c0 < c1) {
+		tmp = c0;
+		c0 = c1;
+		c1 = tmp;
+	}
+
+	dds_put_le16(&dst[0], c0);
+	dds_put_le16(&dst[2], c1);
+
+	if (c0 == c1) {
+		memset(&dst[4], 0, 4);
+		return;
+	}
+
+	bc1_unpack565(c0, palette[0]);
+	bc1_unpack565(c1, palette[1]);
+	for (j = 0; j < 3; j++) {
+		palette[2][j] = (uint8_t)((2 * palette[0][j] + palette[1][j] + 1) / 3);
+		palette[3][j] = (uint8_t)((palette[0][j] + 2 * palette[1][j] + 1) / 3);
+	}
+
+	for (i = 0; i < 16; i++) {
+		best = UINT32_MAX;
+		best_index = 0;
+		for (j = 0; j < 4; j++) {
+			dist = color_distance(block[i], palette[j], 3);
+			if (dist < best) {
+				best = dist;
+				best_index = j;
+			}
+		}
+		indices |= (uint32_t)best_index << (i * 2);
+	}
+
+	dst[4] = (uint8_t)indices;
+	dst[5] = (uint8_t)(indices >> 8);
+	dst[6] = (uint8_t)(indices >> 16);
+	dst[7] = (uint8_t)(indices >> 24);
+}
+
+static void bc3_encode_alpha(uint8_t block[16][4], uint8_t *dst)
+{
+	uint8_t a0 = 0, a1 = 255;
+	uint8_t palette[8];
+	uint64_t indices = 0;
+	uint32_t best, dist;
+	int i, j, best_index;
+
+	for (i = 0; i < 16; i++) {
+		if (block[i][3] > a0)
+			a0 = block[i][3];
+		if (block[i][3] < a1)
+			a1 = block[i][3];
+	}
+
+	dst[0] = a0;
+	dst[1] = a1;
+
+	if (a0 == a1) {
+		memset(&dst[2], 0, 6);
+		return;
+	}
+
+	palette[0] = a0;
+	palette[1] = a1;
+	for (j = 2; j < 8; j++)
+		palette[j] = (uint8_t)(((8 - j) * a0 + (j - 1) * a1 + 3) / 7);
+
+	for (i = 0; i < 16; i++) {
+		best = UINT32_MAX;
+		best_index = 0;
+		for (j = 0; j < 8; j++) {
+			dist = (uint32_t)abs((int)block[i][3] - (int)palette[j]);
+			if (dist < best) {
+				best = dist;
+				best_index = j;
+			}
+		}
+		indices |= (uint64_t)best_index << (i * 3);
+	}
+
+	for (i = 0; i < 6; i++)
+		dst[2 + i] = (uint8_t)(indices >> (i * 8));
+}
+
+struct bc7_bits {
+	uint8_t *dst;
+	unsigned int pos;
+};
+
+static void bc7_put_bits(struct bc7_bits *bits, uint32_t value, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++, bits->pos++) {
+		if (value & (1U << i))
+			bits->dst[bits->pos / 8] |= (uint8_t)(1U << (bits->pos % 8));
+	}
+}
+
+/* quantize an endpoint to 7 bit per channel with a shared p-bit */
+static void bc7_quantize_endpoint(const uint8_t *color, uint8_t *quant,
+				  uint8_t *pbit)
+{
+	uint8_t candidate[2][4];
+	uint32_t error[2] = { 0, 0 };
+	int p, i, value, q;
+
+	for (p = 0; p < 2; p++) {
+		for (i = 0; i < 4; i++) {
+			value = color[i] - p;
+			if (value < 0)
+				value = 0;
+
+			q = (value + 1) >> 1;
+			if (q > 127)
+				q = 127;
+
+			candidate[p][i] = (uint8_t)((q << 1) | p);
+			error[p] += (uint32_t)abs((int)color[i] - (int)candidate[p][i]);
+		}
+	}
+
+	*pbit = error[1] < error[0];
+	memcpy(quant, candidate[*pbit], 4);
+}
+
+/* mode 6: single subset RGBA with 7.7.7.7 + p-bit endpoints and 4 bit
+ * indices. Good enough for textures which mostly use smooth gradients
+ */
+static void bc7_encode_block(uint8_t block[16][4], uint8_t *dst)
+{
+	uint8_t min[4] = { 255, 255, 255, 255 };
+	uint8_t max[4] = { 0, 0, 0, 0 };
+	uint8_t e0[4], e1[4], p0, p1;
+	uint8_t palette[16][4];
+	uint8_t indices[16];
+	struct bc7_bits bits;
+	uint32_t best, dist;
+	uint8_t tmp[4];
+	int i, j, w;
+
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 4; j++) {
+			if (block[i][j] < min[j])
+				min[j] = block[i][j];
+			if (block[i][j] > max[j])
+				max[j] = block[i][j];
+		}
+	}
+
+	bc7_quantize_endpoint(min, e0, &p0);
+	bc7_quantize_endpoint(max, e1, &p1);
+
+	for (w = 0; w < 16; w++) {
+		for (j = 0; j < 4; j++)
+			palette[w][j] = (uint8_t)(((64 - bc7_weights4[w]) * e0[j] +
+						   bc7_weights4[w] * e1[j] + 32) >> 6);
+	}
+
+	for (i = 0; i < 16; i++) {
+		best = UINT32_MAX;
+		indices[i] = 0;
+		for (w = 0; w < 16; w++) {
+			dist = color_distance(block[i], palette[w], 4);
+			if (dist < best) {
+				best = dist;
+				indices[i] = (uint8_t)w;
+			}
+		}
+	}
+
+	/* the msb of the first index is implicitly zero */
+	if (indices[0] & 0x8) {
+		memcpy(tmp, e0, 4);
+		memcpy(e0, e1, 4);
+		memcpy(e1, tmp, 4);
+		tmp[0] = p0;
+		p0 = p1;
+		p1 = tmp[0];
+		for (i = 0; i < 16; i++)
+			indices[i] = (uint8_t)(15 - indices[i]);
+	}
+
+	memset(dst, 0, 16);
+	bits.dst = dst;
+	bits.pos = 0;
+
+	bc7_put_bits(&bits, 1U << 6, 7);
+	for (j = 0; j < 4; j++) {
+		bc7_put_bits(&bits, e0[j] >> 1, 7);
+		bc7_put_bits(&bits, e1[j] >> 1, 7);
+	}
+	bc7_put_bits(&bits, p0, 1);
+	bc7_put_bits(&bits, p1, 1);
+
+	bc7_put_bits(&bits, indices[0], 3);
+	for (i = 1; i < 16; i++)
+		bc7_put_bits(&bits, indices[i], 4);
+}
+
+static void dds_encode_rows(size_t start, size_t end, void *ctx)
+{
+	const struct dds_job *job = ctx;
+	uint8_t block[16][4];
+	uint8_t *dst;
+	size_t by;
+	uint32_t bx;
+
+	for (by = start; by < end; by++) {
+		dst = job->dst + by * job->blocks_x * job->block_size;
+
+		for (bx = 0; bx < job->blocks_x; bx++, dst += job->block_size) {
+			dds_fetch_block(job, bx, (uint32_t)by, block);
+
+			switch (job->compression) {
+			case DDS_BC1:
+				bc1_encode_color(block, dst);
+				break;
+			case DDS_BC3:
+				bc3_encode_alpha(block, dst);
+				bc1_encode_color(block, dst + 8);
+				break;
+			case DDS_BC7:
+			default:
+				bc7_encode_block(block, dst);
+				break;
+			}
+		}
+	}
+}
+
+static enum dds_compression dds_pick_compression(const struct gliden64_file *file)
+{
+	if (globals.dds_compression != DDS_AUTO)
+		return globals.dds_compression;
+
+	switch (file->source_format) {
+	case GR_RGB:
+		return DDS_BC1;
+	case GR_RGB5_A1:
+	case GR_RGBA4:
+		return DDS_BC3;
+	case GR_RGBA8:
+	default:
+		return DDS_BC7;
+	}
+}
+
+int dds_encode(struct gliden64_file *file)
+{
+	enum dds_compression compression;
+	struct dds_header_dxt10 *dxt10;
+	struct dds_header *header;
+	struct dds_job job;
+	size_t header_size;
+	size_t datasize;
+	uint32_t blocks_y;
+	uint8_t *buf;
+
+	if (file->format != GR_BGRA) {
+		fprintf(stderr, "Unsupported texture format %#x for dds export\n", file->format);
+		return -EPERM;
+	}
+
+	compression = dds_pick_compression(file);
+
+	job.src = file->data;
+	job.width = file->width;
+	job.height = file->height;
+	job.compression = compression;
+	job.blocks_x = (file->width + 3) / 4;
+	blocks_y = (file->height + 3) / 4;
+
+	switch (compression) {
+	case DDS_BC1:
+		job.block_size = 8;
+		break;
+	case DDS_BC3:
+	case DDS_BC7:
+		job.block_size = 16;
+		break;
+	case DDS_UNCOMPRESSED:
+	default:
+		job.block_size = 0;
+		break;
+	}
+
+	header_size = sizeof(*header);
+	if (compression == DDS_BC7)
+		header_size += sizeof(*dxt10);
+
+	if (job.block_size)
+		datasize = (size_t)job.blocks_x * blocks_y * job.block_size;
+	else
+		datasize = (size_t)file->width * file->height * 4;
+
+	if (datasize > UINT32_MAX - header_size) {
+		fprintf(stderr, "Too large texture for dds export\n");
+		return -EPERM;
+	}
+
+	buf = malloc(header_size + datasize);
+	if (!buf) {
+		fprintf(stderr, "Memory for DDS file couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	header = (struct dds_header *)buf;
+	memset(buf, 0, header_size);
+	header->magic = htole32(FOURCC('D', 'D', 'S', ' '));
+	header->size = htole32(124);
+	header->height = htole32(file->height);
+	header->width = htole32(file->width);
+	header->pixelformat.size = htole32(32);
+	header->caps = htole32(DDSCAPS_TEXTURE);
+
+	if (compression == DDS_UNCOMPRESSED) {
+		header->flags = htole32(DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH |
+					DDSD_PIXELFORMAT | DDSD_PITCH);
+		header->pitch_or_linear_size = htole32(file->width * 4);
+		header->pixelformat.flags = htole32(DDPF_RGB | DDPF_ALPHAPIXELS);
+		header->pixelformat.rgbbitcount = htole32(32);
+		header->pixelformat.redmask = htole32(0x00ff0000U);
+		header->pixelformat.greenmask = htole32(0x0000ff00U);
+		header->pixelformat.bluemask = htole32(0x000000ffU);
+		header->pixelformat.alphamask = htole32(0xff000000U);
+
+		/* DDS rows are stored top-down like the normalized texture */
+		memcpy(buf + header_size, file->data, datasize);
+	} else {
+		header->flags = htole32(DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH |
+					DDSD_PIXELFORMAT | DDSD_LINEARSIZE);
+		header->pitch_or_linear_size = htole32((uint32_t)datasize);
+		header->pixelformat.flags = htole32(DDPF_FOURCC);
+
+		switch (compression) {
+		case DDS_BC1:
+			header->pixelformat.fourcc = htole32(FOURCC('D', 'X', 'T', '1'));
+			break;
+		case DDS_BC3:
+			header->pixelformat.fourcc = htole32(FOURCC('D', 'X', 'T', '5'));
+			break;
+		default:
+			header->pixelformat.fourcc = htole32(FOURCC('D', 'X', '1', '0'));
+			dxt10 = (struct dds_header_dxt10 *)(buf + sizeof(*header));
+			dxt10->dxgi_format = htole32(DXGI_FORMAT_BC7_UNORM);
+			dxt10->resource_dimension = htole32(D3D10_RESOURCE_DIMENSION_TEXTURE2D);
+			dxt10->array_size = htole32(1);
+			break;
+		}
+
+		job.dst = buf + header_size;
+		parallel_for(blocks_y, dds_encode_rows, &job);
+	}
+
+	free(file->data);
+	file->data = buf;
+	file->size = (uint32_t)(header_size + datasize);
+
+	return 0;
+}
+
+int dds_parse_compression(const char *str)
+{
+	if (strcasecmp(str, "none") == 0)
+		globals.dds_compression = DDS_UNCOMPRESSED;
+	else if (strcasecmp(str, "bc1") == 0)
+		globals.dds_compression = DDS_BC1;
+	else if (strcasecmp(str, "bc3") == 0)
+		globals.dds_compression = DDS_BC3;
+	else if (strcasecmp(str, "bc7") == 0)
+		globals.dds_compression = DDS_BC7;
+	else if (strcasecmp(str, "auto") == 0)
+		globals.dds_compression = DDS_AUTO;
+	else
+		return -EINVAL;
+
+	return 0;
+}
@@ -0,0 +1,341 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum filter_field {
+	FILTER_CHECKSUM,
+	FILTER_WIDTH,
+	FILTER_HEIGHT,
+	FILTER_FORMAT,
+	FILTER_TEXTURE_FORMAT,
+	FILTER_PIXEL_TYPE,
+	FILTER_HIRES,
+	FILTER_SIZE,
+	FILTER_COMPRESSED,
+};
+
+enum filter_op {
+	FILTER_EQ,
+	FILTER_NE,
+	FILTER_LT,
+	FILTER_LE,
+	FILTER_GT,
+	FILTER_GE,
+};
+
+struct filter_cond {
+	enum filter_field field;
+	enum filter_op op;
+	uint64_t value;
+};
+
+static const struct {
+	const char *name;
+	enum filter_field field;
+} filter_fields[] = {
+	{ "checksum",		FILTER_CHECKSUM },
+	{ "width",		FILTER_WIDTH },
+	{ "height",		FILTER_HEIGHT },
+	{ "format",		FILTER_FORMAT },
+	{ "texture_format",	FILTER_TEXTURE_FORMAT },
+	{ "pixel_type",		FILTER_PIXEL_TYPE },
+	{ "hires",		FILTER_HIRES },
+	{ "is_hires_tex",	FILTER_HIRES },
+	{ "size",		FILTER_SIZE },
+	{ "compressed",		FILTER_COMPRESSED },
+};
+
+/* longer operators first to avoid matching their prefixes */
+static const struct {
+	const char *name;
+	enum filter_op op;
+} filter_ops[] = {
+	{ "==", FILTER_EQ },
+	{ "!=", FILTER_NE },
+	{ "<=", FILTER_LE },
+	{ ">=", FILTER_GE },
+	{ "=", FILTER_EQ },
+	{ "<", FILTER_LT },
+	{ ">", FILTER_GT },
+};
+
+static const struct {
+	const char *name;
+	uint32_t format;
+} filter_formats[] = {
+	{ "rgba8",	GR_RGBA8 },
+	{ "rgba8888",	GR_RGBA8 },
+	{ "rgb",	GR_RGB },
+	{ "rgb565",	GR_RGB },
+	{ "rgba4",	GR_RGBA4 },
+	{ "rgba4444",	GR_RGBA4 },
+	{ "rgb5_a1",	GR_RGB5_A1 },
+	{ "rgba5551",	GR_RGB5_A1 },
+};
+
+static struct filter_cond *conds;
+static size_t conds_count;
+
+static uint64_t *checksums;
+static size_t checksums_count;
+static int checksum_list;
+
+static char *filter_strip(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+	*end = '\0';
+
+	return str;
+}
+
+static int filter_parse_value(enum filter_field field, const char *str,
+			      uint64_t *value)
+{
+	char *end;
+	size_t i;
+
+	if (field == FILTER_FORMAT) {
+		for (i = 0; i < sizeof(filter_formats) / sizeof(filter_formats[0]); i++) {
+			if (strcasecmp(filter_formats[i].name, str) == 0) {
+				*value = filter_formats[i].format;
+				return 0;
+			}
+		}
+	}
+
+	/* checksums are printed in hex by -vv and in the file names */
+	if (field == FILTER_CHECKSUM)
+		*value = strtoull(str, &end, 16);
+	else
+		*value = strtoull(str, &end, 0);
+
+	if (*str == '\0' || *end != '\0')
+		return -EINVAL;
+
+	return 0;
+}
+
+static int filter_parse_cond(char *str, struct filter_cond *cond)
+{
+	char *op_pos = NULL;
+	char *name, *value;
+	size_t i, op_len = 0;
+	int found = 0;
+
+	for (i = 0; i < sizeof(filter_ops) / sizeof(filter_ops[0]); i++) {
+		op_pos = strstr(str, filter_ops[i].name);
+		if (op_pos) {
+			cond->op = filter_ops[i].op;
+			op_len = strlen(filter_ops[i].name);
+			break;
+		}
+	}
+
+	if (!op_pos)
+		return -EINVAL;
+
+	*op_pos = '\0';
+	name = filter_strip(str);
+	value = filter_strip(op_pos + op_len);
+
+	for (i = 0; i < sizeof(filter_fields) / sizeof(filter_fields[0]); i++) {
+		if (strcasecmp(filter_fields[i].name, name) == 0) {
+			cond->field = filter_fields[i].field;
+			found = 1;
+			break;
+		}
+	}
+
+	if (!found)
+		return -EINVAL;
+
+	return filter_parse_value(cond->field, value, &cond->value);
+}
+
+int filter_add(const char *expr)
+{
+	struct filter_cond *new_conds;
+	char *copy, *token, *saveptr;
+	int ret = 0;
+
+	copy = strdup(expr);
+	if (!copy)
+		return -ENOMEM;
+
+	for (token = strtok_r(copy, ",", &saveptr); token;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		new_conds = realloc(conds, (conds_count + 1) * sizeof(*conds));
+		if (!new_conds) {
+			ret = -ENOMEM;
+			break;
+		}
+		conds = new_conds;
+
+		ret = filter_parse_cond(token, &conds[conds_count]);
+		if (ret < 0) {
+			fprintf(stderr, "Invalid filter condition \"%s\"\n", token);
+			break;
+		}
+
+		conds_count++;
+	}
+
+	free(copy);
+
+	return ret;
+}
+
+static int filter_compare_checksum(const void *a, const void *b)
+{
+	uint64_t checksum_a = *(const uint64_t *)a;
+	uint64_t checksum_b = *(const uint64_t *)b;
+
+	if (checksum_a < checksum_b)
+		return -1;
+	if (checksum_a > checksum_b)
+		return 1;
+
+	return 0;
+}
+
+int filter_load_checksums(const char *path)
+{
+	uint64_t *new_checksums;
+	char line[128];
+	char *str, *end;
+	uint64_t checksum;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Could not open checksum list %s\n", path);
+		return -ENOENT;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		str = filter_strip(line);
+		if (*str == '\0' || *str == '#')
+			continue;
+
+		checksum = strtoull(str, &end, 16);
+		if (*end != '\0') {
+			fprintf(stderr, "Invalid checksum \"%s\" in %s\n", str, path);
+			ret = -EINVAL;
+			break;
+		}
+
+		new_checksums = realloc(checksums, (checksums_count + 1) * sizeof(*checksums));
+		if (!new_checksums) {
+			ret = -ENOMEM;
+			break;
+		}
+		checksums = new_checksums;
+		checksums[checksums_count++] = checksum;
+	}
+
+	fclose(f);
+
+	if (ret < 0)
+		return ret;
+
+	/* an empty list selects nothing instead of everything */
+	checksum_list = 1;
+	qsort(checksums, checksums_count, sizeof(*checksums), filter_compare_checksum);
+
+	return 0;
+}
+
+static uint64_t filter_field_value(const struct gliden64_file *file,
+				   enum filter_field field)
+{
+	switch (field) {
+	case FILTER_CHECKSUM:
+		return file->checksum;
+	case FILTER_WIDTH:
+		return file->width;
+	case FILTER_HEIGHT:
+		return file->height;
+	case FILTER_FORMAT:
+		return file->format & ~GR_TEXFMT_GZ;
+	case FILTER_TEXTURE_FORMAT:
+		return file->texture_format;
+	case FILTER_PIXEL_TYPE:
+		return file->pixel_type;
+	case FILTER_HIRES:
+		return file->is_hires_tex;
+	case FILTER_SIZE:
+		return file->size;
+	case FILTER_COMPRESSED:
+		return !!(file->format & GR_TEXFMT_GZ);
+	}
+
+	return 0;
+}
+
+static int filter_match_cond(const struct gliden64_file *file,
+			     const struct filter_cond *cond)
+{
+	uint64_t value = filter_field_value(file, cond->field);
+
+	switch (cond->op) {
+	case FILTER_EQ:
+		return value == cond->value;
+	case FILTER_NE:
+		return value != cond->value;
+	case FILTER_LT:
+		return value < cond->value;
+	case FILTER_LE:
+		return value <= cond->value;
+	case FILTER_GT:
+		return value > cond->value;
+	case FILTER_GE:
+		return value >= cond->value;
+	}
+
+	return 0;
+}
+
+int filter_active(void)
+{
+	return conds_count > 0 || checksum_list;
+}
+
+int filter_match(const struct gliden64_file *file)
+{
+	size_t i;
+
+	for (i = 0; i < conds_count; i++) {
+		if (!filter_match_cond(file, &conds[i]))
+			return 0;
+	}
+
+	if (!checksum_list)
+		return 1;
+
+	if (checksums_count == 0 ||
+	    !bsearch(&file->checksum, checksums, checksums_count,
+		     sizeof(*checksums), filter_compare_checksum))
+		return 0;
+
+	return 1;
+}
@@ -17,6 +17,45 @@
 
 struct _globals globals;
 
+#define DEFAULT_SPLIT_THRESHOLD (512 * 512)
+#define DEFAULT_DAEMON_CACHE_SIZE (256 * 1024 * 1024)
+#define DEFAULT_MEMFD_BATCH_SIZE (16 * 1024 * 1024)
+#define DEFAULT_INDEX_SPAN (1024 * 1024)
+
+enum long_only_options {
+	OPT_NO_PREFETCH = 256,
+	OPT_SPLIT_THRESHOLD,
+	OPT_CHECKSUMS,
+	OPT_THUMBNAIL,
+	OPT_ATLAS,
+	OPT_IMAGE_FORMAT,
+	OPT_DDS_COMPRESSION,
+	OPT_MAX_MEMORY,
+	OPT_OUTPUT_FORMAT,
+	OPT_LOOKUP,
+	OPT_DAEMON,
+	OPT_CACHE_SIZE,
+	OPT_OUTPUT_DIR,
+	OPT_INCREMENTAL,
+	OPT_GZIP_INDEX,
+	OPT_BUILD_GZIP_INDEX,
+	OPT_INDEX_SPAN,
+	OPT_VERIFY,
+	OPT_REPORT,
+	OPT_ADAPTIVE,
+	OPT_SHARDS,
+	OPT_SHARD_BY,
+	OPT_CONVERSION,
+	OPT_CATALOG,
+	OPT_CATALOG_QUERY,
+	OPT_CATALOG_SHARED,
+	OPT_FOLLOW,
+	OPT_REORDER,
+	OPT_PROGRESS,
+	OPT_MEMFD_SOCKET,
+	OPT_MEMFD_BATCH,
+};
+
 static int convert_input(void)
 {
 	int ret;
@@ -39,25 +78,39 @@ static int convert_input(void)
 		return ret;
 	}
 
-	while (!feof(globals.in)) {
-		ret = convert_file();
+	if (globals.verify)
+		return verify_input();
+
+	if (globals.report)
+		return report_input(config);
+
+	/* the index knows all headers - only decompress the selected files */
+	if (gzip_index_records() && filter_active()) {
+		ret = gzip_index_convert();
 		if (ret < 0)
 			return ret;
-	}
+	} else {
+		while (!input_eof()) {
+			ret = convert_file();
+			if (ret < 0 && input_eof() && follow_stopped()) {
+				fprintf(stderr, "Incomplete last file of the followed input skipped\n");
+				break;
+			}
 
-	ret = write_tarblock(tarblock, sizeof(tarblock), 0);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to write first EOF tar record\n");
-		return ret;
+			if (ret < 0)
+				return ret;
+		}
 	}
 
-	ret = write_tarblock(tarblock, sizeof(tarblock), 0);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to write second EOF tar record\n");
-		return ret;
+	if (globals.atlas_columns) {
+		ret = atlas_finish();
+		if (ret < 0) {
+			fprintf(stderr, "Failed to write atlas\n");
+			return ret;
+		}
 	}
 
-	return 0;
+	return output_finish();
 }
 
 static void usage(int argc, char *argv[])
@@ -73,16 +126,77 @@ static void usage(int argc, char *argv[])
 	printf("\t -o,--output FILE                  Use FILE as output file (default: stdout)\n");
 	printf("\t -p,--prefix NAME                  Add prefix to each file\n");
 	printf("\t -t,--type [hires|tex]             Type of the input\n");
+	printf("\t    --progress                     Print input position, rates and ETA every second on stderr\n");
+	printf("\t                                   (SIGUSR1 prints the counters of all stages at any time)\n");
 	printf("\t -v,--verbose                      Print extra information on stderr (repeat for more verbosity)\n");
 	printf("\t -e,--ignore-error                 Skip current file when an conversion error is detected\n");
+	printf("\t -r,--recover                      Search for the next valid file after damaged data\n");
 	printf("\t -b,--bitmapv5                     Use V5 Windows Bitmap files with ImageMagick compatible alpha channels\n");
+	printf("\t -n,--native                       Keep the pixel format of the texture (16 bit BMPs with bitfield masks)\n");
+	printf("\t -u,--io-uring                     Use io_uring for regular input/output files (Linux only)\n");
+	printf("\t    --no-prefetch                  Don't read pipe input ahead in a separate thread\n");
+	printf("\t    --follow                       Wait for new files at the end of the input file until SIGINT\n");
+	printf("\t -j,--jobs N                       Use N threads for large textures (0: one per CPU, default: 1)\n");
+	printf("\t    --conversion [auto|lut|scalar] Expand 16 bit pixels with lookup tables or bit operations\n");
+	printf("\t                                   (default: auto, benchmarks both at startup)\n");
+	printf("\t    --split-threshold PIXELS       Minimum texture size to split it between threads (default: %u)\n", DEFAULT_SPLIT_THRESHOLD);
+	printf("\t -f,--filter EXPR                  Only extract files matching all comma separated conditions\n");
+	printf("\t                                   FIELD OP VALUE with OP one of == != < <= > >= and FIELD one of\n");
+	printf("\t                                   checksum, width, height, format, texture_format, pixel_type,\n");
+	printf("\t                                   hires, size, compressed (e.g. \"hires==1,format==rgba8,width>=256\")\n");
+	printf("\t    --checksums FILE               Only extract files with a checksum (hex, one per line) from FILE\n");
+	printf("\t    --thumbnail WxH                Only write previews which fit into WxH pixels\n");
+	printf("\t    --atlas COLSxROWS              Pack the previews into contact sheets with a manifest\n");
+	printf("\t    --image-format [bmp|dds]       File format of the extracted textures (default: bmp)\n");
+	printf("\t    --adaptive                     Write opaque textures as 8 bit palette or 24 bit BMPs\n");
+	printf("\t    --dds-compression MODE         none, bc1, bc3, bc7 or auto (by source format, default)\n");
+	printf("\t    --output-format [tar|blob]     Write a tar file (default) or a blob store with checksum index\n");
+	printf("\t    --verify                       Check all files of the cache without writing output\n");
+	printf("\t    --report                       Write statistics about the files of the cache as JSON\n");
+	printf("\t    --lookup CHECKSUM              Write the texture with CHECKSUM (hex) from the blob store input\n");
+	printf("\t    --output-dir DIR               Write the textures as files into DIR with a manifest\n");
+	printf("\t    --incremental                  Skip textures which are unchanged since the manifest was written\n");
+	printf("\t    --reorder SIZE                 Group similar textures in the tar file, buffering up to SIZE bytes\n");
+	printf("\t    --shards N                     Spread the textures over the N tar files OUTPUT.0 to OUTPUT.N-1\n");
+	printf("\t                                   and write a manifest to OUTPUT\n");
+	printf("\t    --shard-by [checksum|size]     Assign shards by checksum hash (default) or balance their size\n");
+	printf("\t    --memfd-socket SOCKET          Send the BGRA pixels in sealed memfds to the unix SOCKET (Linux only)\n");
+	printf("\t    --memfd-batch SIZE             Size of a memfd with multiple textures (default: 16M)\n");
+	printf("\t    --build-gzip-index FILE        Write an access index for the gzip compressed input to FILE\n");
+	printf("\t    --gzip-index FILE              Read the gzip compressed input with the access index FILE\n");
+	printf("\t    --index-span SIZE              Uncompressed distance between access points (default: 1M)\n");
+	printf("\t    --daemon SOCKET                Serve textures of the CACHE files on the unix SOCKET\n");
+	printf("\t    --cache-size SIZE              Memory for decoded textures of the daemon (default: 256M)\n");
+	printf("\t    --catalog FILE                 Add the files of the CACHE files to the checksum catalog FILE\n");
+	printf("\t    --catalog-query CHECKSUM       Write the locations of CHECKSUM (hex) in the caches of the catalog\n");
+	printf("\t    --catalog-shared               Write the locations of all checksums stored in several caches\n");
+	printf("\t    --max-memory SIZE              Limit memory of buffers and files in flight (suffix K, M or G)\n");
 	printf("\t -h,--help                         Show this message and exit\n");
 }
 
+/* the options which select the output format exclude each other */
+static int select_output_format(enum output_format format, const char *option,
+				const char **selected)
+{
+	if (*selected && strcmp(*selected, option) != 0) {
+		fprintf(stderr, "%s can't be used with %s\n", option, *selected);
+		return -EINVAL;
+	}
+
+	*selected = option;
+	globals.output_format = format;
+
+	return 0;
+}
+
 static int init(int argc, char *argv[])
 {
+	const char *output_option = NULL;
+	enum output_format format;
 	int o;
 	int options_index;
+	int jobs_set = 0;
+	char *end;
 
 	static const struct option long_options[] = {
 		{"verbose",		no_argument,		NULL, 'v'},
@@ -90,9 +204,45 @@ static int init(int argc, char *argv[])
 		{"type",		required_argument,	NULL, 'p'},
 		{"help",		no_argument,		NULL, 'h'},
 		{"ignore-error",	no_argument,		NULL, 'e'},
+		{"recover",		no_argument,		NULL, 'r'},
 		{"bitmapv5",		no_argument,		NULL, 'b'},
 		{"input",		required_argument,	NULL, 'i'},
 		{"output",		required_argument,	NULL, 'o'},
+		{"io-uring",		no_argument,		NULL, 'u'},
+		{"native",		no_argument,		NULL, 'n'},
+		{"jobs",		required_argument,	NULL, 'j'},
+		{"conversion",		required_argument,	NULL, OPT_CONVERSION},
+		{"split-threshold",	required_argument,	NULL, OPT_SPLIT_THRESHOLD},
+		{"filter",		required_argument,	NULL, 'f'},
+		{"checksums",		required_argument,	NULL, OPT_CHECKSUMS},
+		{"thumbnail",		required_argument,	NULL, OPT_THUMBNAIL},
+		{"atlas",		required_argument,	NULL, OPT_ATLAS},
+		{"image-format",	required_argument,	NULL, OPT_IMAGE_FORMAT},
+		{"adaptive",		no_argument,		NULL, OPT_ADAPTIVE},
+		{"dds-compression",	required_argument,	NULL, OPT_DDS_COMPRESSION},
+		{"progress",		no_argument,		NULL, OPT_PROGRESS},
+		{"follow",		no_argument,		NULL, OPT_FOLLOW},
+		{"no-prefetch",		no_argument,		NULL, OPT_NO_PREFETCH},
+		{"max-memory",		required_argument,	NULL, OPT_MAX_MEMORY},
+		{"output-format",	required_argument,	NULL, OPT_OUTPUT_FORMAT},
+		{"verify",		no_argument,		NULL, OPT_VERIFY},
+		{"report",		no_argument,		NULL, OPT_REPORT},
+		{"lookup",		required_argument,	NULL, OPT_LOOKUP},
+		{"catalog",		required_argument,	NULL, OPT_CATALOG},
+		{"catalog-query",	required_argument,	NULL, OPT_CATALOG_QUERY},
+		{"catalog-shared",	no_argument,		NULL, OPT_CATALOG_SHARED},
+		{"output-dir",		required_argument,	NULL, OPT_OUTPUT_DIR},
+		{"incremental",		no_argument,		NULL, OPT_INCREMENTAL},
+		{"reorder",		required_argument,	NULL, OPT_REORDER},
+		{"memfd-socket",	required_argument,	NULL, OPT_MEMFD_SOCKET},
+		{"memfd-batch",		required_argument,	NULL, OPT_MEMFD_BATCH},
+		{"shards",		required_argument,	NULL, OPT_SHARDS},
+		{"shard-by",		required_argument,	NULL, OPT_SHARD_BY},
+		{"gzip-index",		required_argument,	NULL, OPT_GZIP_INDEX},
+		{"build-gzip-index",	required_argument,	NULL, OPT_BUILD_GZIP_INDEX},
+		{"index-span",		required_argument,	NULL, OPT_INDEX_SPAN},
+		{"daemon",		required_argument,	NULL, OPT_DAEMON},
+		{"cache-size",		required_argument,	NULL, OPT_CACHE_SIZE},
 		{NULL,			0,			NULL,  0 },
 	};
 
@@ -101,8 +251,13 @@ static int init(int argc, char *argv[])
 
 	globals.in = stdin;
 	globals.out = stdout;
+	globals.jobs = 1;
+	globals.split_threshold = DEFAULT_SPLIT_THRESHOLD;
+	globals.daemon_cache_size = DEFAULT_DAEMON_CACHE_SIZE;
+	globals.memfd_batch_size = DEFAULT_MEMFD_BATCH_SIZE;
+	globals.index_span = DEFAULT_INDEX_SPAN;
 
-	while ((o = getopt_long(argc, argv, "vp:t:ebhi:o:", long_options, &options_index)) != -1) {
+	while ((o = getopt_long(argc, argv, "vp:t:erbhi:o:unj:f:", long_options, &options_index)) != -1) {
 		switch (o) {
 		case 'v':
 			globals.verbose++;
@@ -131,9 +286,204 @@ static int init(int argc, char *argv[])
 		case 'e':
 			globals.ignore_error = 1;
 			break;
+		case 'r':
+			globals.recover = 1;
+			break;
 		case 'b':
 			globals.bitmapv5 = 1;
 			break;
+		case 'u':
+			globals.io_uring = 1;
+			break;
+		case 'n':
+			globals.native = 1;
+			break;
+		case OPT_NO_PREFETCH:
+			globals.no_prefetch = 1;
+			break;
+		case OPT_PROGRESS:
+			globals.progress = 1;
+			break;
+		case OPT_FOLLOW:
+			globals.follow = 1;
+			break;
+		case 'j':
+			globals.jobs = (unsigned int)strtoul(optarg, &end, 0);
+			jobs_set = 1;
+			if (*end != '\0') {
+				fprintf(stderr, "Invalid number of jobs %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'f':
+			if (filter_add(optarg) < 0)
+				return -EINVAL;
+			break;
+		case OPT_CHECKSUMS:
+			if (filter_load_checksums(optarg) < 0)
+				return -EINVAL;
+			break;
+		case OPT_THUMBNAIL:
+			if (parse_dimensions(optarg, &globals.thumbnail_width, &globals.thumbnail_height) < 0) {
+				fprintf(stderr, "Invalid thumbnail size %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_ATLAS:
+			if (parse_dimensions(optarg, &globals.atlas_columns, &globals.atlas_rows) < 0) {
+				fprintf(stderr, "Invalid atlas size %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_IMAGE_FORMAT:
+			if (strcasecmp(optarg, "bmp") == 0) {
+				globals.image_format = IMAGE_BMP;
+			} else if (strcasecmp(optarg, "dds") == 0) {
+				globals.image_format = IMAGE_DDS;
+			} else {
+				fprintf(stderr, "Invalid image format %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_ADAPTIVE:
+			globals.adaptive = 1;
+			break;
+		case OPT_DDS_COMPRESSION:
+			if (dds_parse_compression(optarg) < 0) {
+				fprintf(stderr, "Invalid DDS compression %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_OUTPUT_FORMAT:
+			if (strcasecmp(optarg, "tar") == 0) {
+				format = OUTPUT_TAR;
+			} else if (strcasecmp(optarg, "blob") == 0) {
+				format = OUTPUT_BLOB;
+			} else {
+				fprintf(stderr, "Invalid output format %s\n", optarg);
+				return -EINVAL;
+			}
+
+			if (select_output_format(format, "--output-format", &output_option) < 0)
+				return -EINVAL;
+			break;
+		case OPT_VERIFY:
+			globals.verify = 1;
+			break;
+		case OPT_REPORT:
+			globals.report = 1;
+			break;
+		case OPT_LOOKUP:
+			globals.lookup = 1;
+			globals.lookup_checksum = strtoull(optarg, &end, 16);
+			if (*optarg == '\0' || *end != '\0') {
+				fprintf(stderr, "Invalid checksum %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_CATALOG:
+			globals.catalog = optarg;
+			break;
+		case OPT_CATALOG_QUERY:
+			globals.catalog_query = 1;
+			globals.catalog_checksum = strtoull(optarg, &end, 16);
+			if (*optarg == '\0' || *end != '\0') {
+				fprintf(stderr, "Invalid checksum %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_CATALOG_SHARED:
+			globals.catalog_shared = 1;
+			break;
+		case OPT_OUTPUT_DIR:
+			if (select_output_format(OUTPUT_DIR, "--output-dir", &output_option) < 0)
+				return -EINVAL;
+			globals.output_dir = optarg;
+			break;
+		case OPT_INCREMENTAL:
+			globals.incremental = 1;
+			break;
+		case OPT_MEMFD_SOCKET:
+			if (select_output_format(OUTPUT_MEMFD, "--memfd-socket", &output_option) < 0)
+				return -EINVAL;
+			globals.memfd_socket = optarg;
+			break;
+		case OPT_MEMFD_BATCH:
+			if (budget_parse(optarg, &globals.memfd_batch_size) < 0) {
+				fprintf(stderr, "Invalid memfd batch size %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_REORDER:
+			if (budget_parse(optarg, &globals.reorder_size) < 0 ||
+			    globals.reorder_size == 0) {
+				fprintf(stderr, "Invalid reorder buffer size %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_SHARDS:
+			globals.shards = (unsigned int)strtoul(optarg, &end, 0);
+			if (*end != '\0' || globals.shards == 0) {
+				fprintf(stderr, "Invalid number of shards %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_SHARD_BY:
+			if (strcasecmp(optarg, "checksum") == 0) {
+				globals.shard_by_size = 0;
+			} else if (strcasecmp(optarg, "size") == 0) {
+				globals.shard_by_size = 1;
+			} else {
+				fprintf(stderr, "Invalid shard assignment %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_GZIP_INDEX:
+			globals.gzip_index = optarg;
+			break;
+		case OPT_BUILD_GZIP_INDEX:
+			globals.build_gzip_index = optarg;
+			break;
+		case OPT_INDEX_SPAN:
+			if (budget_parse(optarg, &globals.index_span) < 0) {
+				fprintf(stderr, "Invalid index span %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_DAEMON:
+			globals.daemon_socket = optarg;
+			break;
+		case OPT_CACHE_SIZE:
+			if (budget_parse(optarg, &globals.daemon_cache_size) < 0) {
+				fprintf(stderr, "Invalid cache size %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_MAX_MEMORY:
+			if (budget_parse(optarg, &globals.max_memory) < 0) {
+				fprintf(stderr, "Invalid memory budget %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_CONVERSION:
+			if (strcasecmp(optarg, "auto") == 0) {
+				globals.conversion = CONVERSION_AUTO;
+			} else if (strcasecmp(optarg, "lut") == 0) {
+				globals.conversion = CONVERSION_LUT;
+			} else if (strcasecmp(optarg, "scalar") == 0) {
+				globals.conversion = CONVERSION_SCALAR;
+			} else {
+				fprintf(stderr, "Invalid conversion %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case OPT_SPLIT_THRESHOLD:
+			globals.split_threshold = strtoull(optarg, &end, 0);
+			if (*end != '\0') {
+				fprintf(stderr, "Invalid split threshold %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
 		case 'i':
 			if (globals.in != stdin)
 				fclose(globals.in);
@@ -153,6 +503,7 @@ static int init(int argc, char *argv[])
 				fprintf(stderr, "Could not open output file %s\n", optarg);
 				return -ENOENT;
 			}
+			globals.output_path = optarg;
 			break;
 		default:
 			usage(argc, argv);
@@ -160,9 +511,114 @@ static int init(int argc, char *argv[])
 		}
 	}
 
+	/* verification has no output which has to stay in order */
+	if (globals.verify && !jobs_set)
+		globals.jobs = 0;
+
+	if (globals.verify && globals.recover) {
+		fprintf(stderr, "--verify can't be used with --recover\n");
+		return -EINVAL;
+	}
+
+	/* both replace the input backend or never reach the end of the input */
+	if (globals.follow && (globals.recover || globals.gzip_index ||
+			       globals.verify || globals.report)) {
+		fprintf(stderr, "--follow can't be used with --recover, --gzip-index, --verify or --report\n");
+		return -EINVAL;
+	}
+
+	if (globals.adaptive && (globals.native || globals.image_format != IMAGE_BMP)) {
+		fprintf(stderr, "--adaptive requires BMP output without --native\n");
+		return -EINVAL;
+	}
+
+	if ((globals.catalog_query || globals.catalog_shared) && !globals.catalog) {
+		fprintf(stderr, "--catalog-query and --catalog-shared require --catalog\n");
+		return -EINVAL;
+	}
+
+	/* a filtered catalog would lose files on its next update */
+	if (globals.catalog && filter_active()) {
+		fprintf(stderr, "--catalog can't be used with --filter or --checksums\n");
+		return -EINVAL;
+	}
+
+	if (globals.atlas_columns && !globals.thumbnail_width) {
+		fprintf(stderr, "--atlas requires --thumbnail\n");
+		return -EINVAL;
+	}
+
+	/* blob stores and the daemon are only indexed by the texture checksums */
+	if (globals.atlas_columns && globals.daemon_socket) {
+		fprintf(stderr, "--atlas can't be used with --daemon\n");
+		return -EINVAL;
+	}
+
+	/* the daemon has no single input to report a position of */
+	if (globals.progress && globals.daemon_socket) {
+		fprintf(stderr, "--progress can't be used with --daemon\n");
+		return -EINVAL;
+	}
+
+	if (globals.gzip_index && globals.recover) {
+		fprintf(stderr, "--gzip-index can't be used with --recover\n");
+		return -EINVAL;
+	}
+
+	if (globals.incremental && globals.output_format != OUTPUT_DIR) {
+		fprintf(stderr, "--incremental requires --output-dir\n");
+		return -EINVAL;
+	}
+
+	if (globals.shards) {
+		if (globals.output_format != OUTPUT_TAR || !globals.output_path) {
+			fprintf(stderr, "--shards requires tar output into a file\n");
+			return -EINVAL;
+		}
+
+		globals.output_format = OUTPUT_SHARDS;
+	}
+
+	if (globals.reorder_size && (globals.output_format != OUTPUT_TAR ||
+				     globals.atlas_columns)) {
+		fprintf(stderr, "--reorder requires tar output without --atlas\n");
+		return -EINVAL;
+	}
+
+	/* waiting for input must not decide which files are sorted together */
+	if (globals.reorder_size && globals.follow) {
+		fprintf(stderr, "--reorder can't be used with --follow\n");
+		return -EINVAL;
+	}
+
+	/* the pixels are sent as they are after normalization */
+	if (globals.output_format == OUTPUT_MEMFD &&
+	    (globals.native || globals.adaptive || globals.image_format != IMAGE_BMP)) {
+		fprintf(stderr, "--memfd-socket can't be used with --native, --adaptive or DDS output\n");
+		return -EINVAL;
+	}
+
+	if (globals.atlas_columns && globals.output_format != OUTPUT_TAR) {
+		fprintf(stderr, "--atlas can only be written to tar files\n");
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
+static void init_io_uring(void)
+{
+	int ret;
+
+	ret = io_uring_input_init();
+	if (ret < 0 && globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "io_uring not used for input: %s\n", strerror(-ret));
+
+	ret = io_uring_output_init();
+	if (ret < 0 && globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "io_uring not used for output: %s\n", strerror(-ret));
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
@@ -173,7 +629,114 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (globals.lookup) {
+		ret = blob_store_lookup(globals.lookup_checksum);
+		if (ret < 0)
+			return 2;
+
+		return 0;
+	}
+
+	if (globals.catalog) {
+		ret = catalog_run(&argv[optind], (unsigned int)(argc - optind));
+		if (ret < 0)
+			return 2;
+
+		return 0;
+	}
+
+	/* also started for the daemon - SIGUSR1 would terminate it otherwise */
+	ret = progress_init();
+	if (ret < 0) {
+		fprintf(stderr, "Failed to start progress thread: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	ret = parallel_init(globals.jobs);
+	if (ret < 0)
+		return 1;
+
+	ret = conversion_init();
+	if (ret < 0)
+		return 1;
+
+	if (globals.daemon_socket) {
+		ret = daemon_run(&argv[optind], (unsigned int)(argc - optind));
+		if (ret < 0)
+			return 2;
+
+		return 0;
+	}
+
+	if (globals.build_gzip_index) {
+		ret = gzip_index_build(globals.build_gzip_index, globals.index_span);
+		if (ret < 0)
+			return 2;
+
+		return 0;
+	}
+
+	if (globals.gzip_index) {
+		ret = gzip_index_input_init(globals.gzip_index);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to use gzip index: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
+
+	if (globals.recover) {
+		ret = recover_input_init();
+		if (ret < 0) {
+			fprintf(stderr, "Failed to load input for recovery: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
+
+	if (globals.follow) {
+		ret = follow_input_init();
+		if (ret < 0) {
+			fprintf(stderr, "Failed to follow input: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
+
+	if (globals.io_uring && !globals.input_backend)
+		init_io_uring();
+
+	if (!globals.input_backend && !globals.no_prefetch) {
+		ret = prefetch_input_init();
+		if (ret < 0 && ret != -EOPNOTSUPP)
+			fprintf(stderr, "Failed to start input prefetch thread: %s\n", strerror(-ret));
+	}
+
+	if (globals.output_format == OUTPUT_DIR) {
+		ret = output_dir_init();
+		if (ret < 0)
+			return 1;
+	}
+
+	if (globals.output_format == OUTPUT_SHARDS) {
+		ret = shards_init(globals.output_path, globals.shards);
+		if (ret < 0)
+			return 1;
+	}
+
+	if (globals.output_format == OUTPUT_MEMFD) {
+		ret = memfd_output_init();
+		if (ret < 0) {
+			fprintf(stderr, "Failed to start memfd output: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
+
+	if (globals.reorder_size) {
+		ret = reorder_init();
+		if (ret < 0)
+			return 1;
+	}
+
 	ret = convert_input();
+	progress_finish();
 	if (ret < 0)
 		return 2;
 
@@ -166,6 +166,9 @@ static inline uint64_t le64toh(uint64_t little_endian_64bits)
 #define GR_BGRA             0x80E1
 #define GR_TEXFMT_GZ        0x80000000U
 
+/* size of the packed file header in the cache */
+#define FILE_HEADER_SIZE 29
+
 struct gliden64_file {
 	void *data;
 	uint64_t checksum;
@@ -176,6 +179,10 @@ struct gliden64_file {
 	uint16_t pixel_type;
 	uint8_t is_hires_tex;
 	uint32_t size;
+	uint32_t source_format;
+	uint32_t payload_crc;
+	/* memory budget held for this file, 0 without --max-memory */
+	uint64_t reserved;
 };
 
 enum verbosity_level {
@@ -189,16 +196,98 @@ enum input_type {
 	INPUT_TEX,
 };
 
+enum image_format {
+	IMAGE_BMP = 0,
+	IMAGE_DDS,
+};
+
+enum conversion_mode {
+	CONVERSION_AUTO = 0,
+	CONVERSION_SCALAR,
+	CONVERSION_LUT,
+};
+
+enum output_format {
+	OUTPUT_TAR = 0,
+	OUTPUT_BLOB,
+	OUTPUT_DIR,
+	OUTPUT_SHARDS,
+	OUTPUT_MEMFD,
+};
+
+enum dds_compression {
+	DDS_AUTO = 0,
+	DDS_UNCOMPRESSED,
+	DDS_BC1,
+	DDS_BC3,
+	DDS_BC7,
+};
+
 extern uint8_t tarblock[512];
 
+struct input_backend {
+	/* returns the next chunk of input data, len is 0 on end of stream */
+	int (*next_chunk)(const uint8_t **data, size_t *len);
+	/* optional, returns the chunk continuing at offset */
+	int (*seek)(uint64_t offset, const uint8_t **data, size_t *len);
+	/* optional, size of the data when it isn't the size of globals.in */
+	uint64_t (*size)(void);
+};
+
+struct output_backend {
+	int (*write)(const void *buffer, size_t size);
+	int (*flush)(void);
+};
+
 struct _globals {
 	int verbose;
+	int progress;
 	enum input_type type;
 	int ignore_error;
+	int recover;
 	int bitmapv5;
+	int native;
+	int adaptive;
+	enum conversion_mode conversion;
+	int io_uring;
+	int no_prefetch;
+	int follow;
+	unsigned int jobs;
+	uint64_t max_memory;
+	uint64_t split_threshold;
+	uint32_t thumbnail_width;
+	uint32_t thumbnail_height;
+	uint32_t atlas_columns;
+	uint32_t atlas_rows;
+	enum image_format image_format;
+	enum dds_compression dds_compression;
+	enum output_format output_format;
+	int verify;
+	int report;
+	int lookup;
+	uint64_t lookup_checksum;
+	const char *catalog;
+	int catalog_query;
+	uint64_t catalog_checksum;
+	int catalog_shared;
+	const char *output_dir;
+	int incremental;
+	const char *output_path;
+	uint64_t reorder_size;
+	unsigned int shards;
+	int shard_by_size;
+	const char *memfd_socket;
+	uint64_t memfd_batch_size;
+	const char *gzip_index;
+	const char *build_gzip_index;
+	uint64_t index_span;
+	const char *daemon_socket;
+	uint64_t daemon_cache_size;
 	char *prefix;
 	FILE *in;
 	FILE *out;
+	const struct input_backend *input_backend;
+	const struct output_backend *output_backend;
 };
 extern struct _globals globals;
 
@@ -217,10 +306,113 @@ struct tar_header {
 int parse_config(uint32_t config);
 
 int convert_file(void);
+void input_set_backend(const struct input_backend *backend, uint64_t offset);
+void input_set_file(FILE *file);
+int input_eof(void);
+long input_tell(void);
+int input_skip(uint64_t size, int print_error);
+int input_seek(uint64_t offset);
+int input_remaining(uint64_t *remaining, uint64_t needed);
+int get_buffer(void *buffer, size_t size, int print_error);
 int get_buffer_endian(void *buffer, size_t size, int print_error);
 #define get_item(x) get_buffer_endian(&x, sizeof(x), 1)
+void parse_file_header(const uint8_t *header, struct gliden64_file *file);
+int read_file_header(struct gliden64_file *file);
+int decompress_file(struct gliden64_file *file);
+int conversion_init(void);
+int normalize_image(struct gliden64_file *file);
 int prepare_file(struct gliden64_file *file);
-int write_tarblock(void *buffer, size_t size, size_t offset);
+int verify_file(const struct gliden64_file *file, const char **error);
+uint64_t image_memory_estimate(const struct gliden64_file *file);
+unsigned int texture_bytes_per_pixel(uint32_t format);
+int encode_image(struct gliden64_file *file);
+size_t tar_padding(size_t size);
+int write_tarblock(void *buffer, size_t size);
+const char *image_extension(void);
+void file_name(const struct gliden64_file *file, char *name, size_t size);
+void tar_entry_header(struct tar_header *header, const char *name, uint32_t size);
+int write_tar_entry(const char *name, void *data, uint32_t size);
 int write_file(struct gliden64_file *file);
+int output_write(const void *buffer, size_t size);
+int output_flush(void);
+int output_finish(void);
+
+int blob_store_add(const struct gliden64_file *file);
+int blob_store_finish(void);
+int blob_store_lookup(uint64_t checksum);
+
+int output_dir_init(void);
+int output_dir_unchanged(const struct gliden64_file *file);
+int output_dir_add(const struct gliden64_file *file);
+int output_dir_finish(void);
+
+int reorder_init(void);
+int reorder_add(struct gliden64_file *file);
+int reorder_finish(void);
+
+int shards_init(const char *path, unsigned int count);
+int shards_add(struct gliden64_file *file);
+int shards_finish(void);
+
+int memfd_output_init(void);
+int memfd_output_add(const struct gliden64_file *file);
+int memfd_output_finish(void);
+
+int gzip_index_build(const char *path, uint64_t span);
+int gzip_index_input_init(const char *path);
+int gzip_index_records(void);
+int gzip_index_convert(void);
+
+int verify_input(void);
+int report_input(uint32_t config);
+
+int daemon_run(char *paths[], unsigned int count);
+
+int catalog_run(char *paths[], unsigned int count);
+
+int io_uring_input_init(void);
+int io_uring_output_init(void);
+
+int prefetch_input_init(void);
+
+int progress_init(void);
+void progress_finish(void);
+void progress_read(long offset);
+void progress_filtered(void);
+void progress_decompressed(uint64_t compressed, uint64_t decompressed);
+void progress_failed(void);
+void progress_written(uint64_t size);
+
+int follow_input_init(void);
+int follow_stopped(void);
+
+int recover_input_init(void);
+int recover_header_plausible(long offset);
+int recover_resync(long offset);
+
+int filter_add(const char *expr);
+int filter_load_checksums(const char *path);
+int filter_active(void);
+int filter_match(const struct gliden64_file *file);
+
+int parse_dimensions(const char *str, uint32_t *width, uint32_t *height);
+int thumbnail_resize(struct gliden64_file *file);
+int atlas_add(struct gliden64_file *file);
+int atlas_finish(void);
+
+int dds_encode(struct gliden64_file *file);
+int dds_parse_compression(const char *str);
+
+typedef void (*parallel_fn)(size_t start, size_t end, void *ctx);
+int parallel_init(unsigned int threads);
+unsigned int parallel_threads(void);
+void parallel_for(size_t count, parallel_fn fn, void *ctx);
+
+int budget_parse(const char *str, uint64_t *bytes);
+int budget_reserve_static(uint64_t size);
+void budget_release_static(uint64_t size);
+int budget_reserve(uint64_t size);
+void budget_release(uint64_t size);
+void budget_usage(uint64_t *fixed, uint64_t *dynamic);
 
 #endif
@@ -0,0 +1,719 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * Access index for gzip (or zlib) compressed caches, based on the idea of
+ * zran.c from the zlib examples. Decompression can only start at a deflate
+ * block boundary and needs the 32 KiB of output before it. Such access
+ * points are stored every span bytes of uncompressed data. The index also
+ * stores the offset and header of every file in the uncompressed cache.
+ *
+ * Index file layout (all integers little endian):
+ *
+ *  - struct gzip_index_header
+ *  - points_count times struct gzip_index_point followed by its window
+ *  - records_count times struct gzip_index_record
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define GZIP_INDEX_MAGIC "GLN64GZI"
+#define GZIP_INDEX_VERSION 1
+#define GZIP_WINDOW_SIZE 32768
+#define GZIP_CHUNK_SIZE (64 * 1024)
+
+#pragma pack(push, 1)
+struct gzip_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t span;
+	uint64_t compressed_size;
+	uint64_t uncompressed_size;
+	uint64_t points_count;
+	uint64_t records_count;
+};
+
+struct gzip_index_point {
+	uint64_t uncompressed_offset;
+	uint64_t compressed_offset;
+	uint8_t bits;
+	uint8_t reserved[7];
+};
+
+struct gzip_index_record {
+	uint64_t offset;
+	uint8_t header[FILE_HEADER_SIZE];
+	uint8_t reserved[3];
+};
+#pragma pack(pop)
+
+struct gzip_point {
+	uint64_t uncompressed_offset;
+	uint64_t compressed_offset;
+	uint8_t bits;
+	uint8_t *window;
+};
+
+static struct {
+	struct gzip_point *points;
+	size_t points_count;
+	size_t points_capacity;
+	struct gzip_index_record *records;
+	size_t records_count;
+	size_t records_capacity;
+	uint64_t uncompressed_size;
+	uint64_t compressed_size;
+
+	/* file header parser of the index builder */
+	uint64_t next_header;
+	uint8_t header[FILE_HEADER_SIZE];
+	size_t header_fill;
+
+	/* spans which were inflated together for the input backend */
+	int fd;
+	uint8_t **buffers;
+	int *errors;
+	size_t batch;
+	size_t first;
+	size_t loaded;
+	size_t next;
+} gz;
+
+static int gzip_add_point(uint8_t bits, uint64_t compressed_offset,
+			  uint64_t uncompressed_offset, unsigned int left,
+			  const uint8_t *window)
+{
+	struct gzip_point *points;
+	struct gzip_point *point;
+
+	if (gz.points_count == gz.points_capacity) {
+		gz.points_capacity = gz.points_capacity ? gz.points_capacity * 2 : 64;
+		points = realloc(gz.points, gz.points_capacity * sizeof(*points));
+		if (!points)
+			return -ENOMEM;
+		gz.points = points;
+	}
+
+	point = &gz.points[gz.points_count];
+	point->window = malloc(GZIP_WINDOW_SIZE);
+	if (!point->window)
+		return -ENOMEM;
+
+	point->uncompressed_offset = uncompressed_offset;
+	point->compressed_offset = compressed_offset;
+	point->bits = bits;
+
+	/* the output window is used as ring buffer */
+	if (left)
+		memcpy(point->window, window + GZIP_WINDOW_SIZE - left, left);
+	if (left < GZIP_WINDOW_SIZE)
+		memcpy(point->window + left, window, GZIP_WINDOW_SIZE - left);
+
+	gz.points_count++;
+
+	return 0;
+}
+
+static int gzip_add_record(void)
+{
+	struct gzip_index_record *records;
+	struct gzip_index_record *record;
+
+	if (gz.records_count == gz.records_capacity) {
+		gz.records_capacity = gz.records_capacity ? gz.records_capacity * 2 : 1024;
+		records = realloc(gz.records, gz.records_capacity * sizeof(*records));
+		if (!records)
+			return -ENOMEM;
+		gz.records = records;
+	}
+
+	record = &gz.records[gz.records_count++];
+	memset(record, 0, sizeof(*record));
+	record->offset = gz.next_header;
+	memcpy(record->header, gz.header, sizeof(record->header));
+
+	return 0;
+}
+
+/* follows the file headers in the freshly inflated data */
+static int gzip_scan_records(const uint8_t *data, size_t len, uint64_t offset)
+{
+	struct gliden64_file file;
+	uint64_t wanted;
+	size_t skip, copy;
+	int ret;
+
+	while (len > 0) {
+		wanted = gz.next_header + gz.header_fill;
+		if (offset + len <= wanted)
+			return 0;
+
+		if (offset < wanted) {
+			skip = (size_t)(wanted - offset);
+			data += skip;
+			len -= skip;
+			offset += skip;
+		}
+
+		copy = sizeof(gz.header) - gz.header_fill;
+		if (copy > len)
+			copy = len;
+
+		memcpy(gz.header + gz.header_fill, data, copy);
+		gz.header_fill += copy;
+		data += copy;
+		len -= copy;
+		offset += copy;
+
+		if (gz.header_fill < sizeof(gz.header))
+			continue;
+
+		ret = gzip_add_record();
+		if (ret < 0)
+			return ret;
+
+		parse_file_header(gz.header, &file);
+		gz.next_header += sizeof(gz.header) + file.size;
+		gz.header_fill = 0;
+	}
+
+	return 0;
+}
+
+static int gzip_write_index(const char *path, uint32_t span)
+{
+	struct gzip_index_record record;
+	struct gzip_index_header header;
+	struct gzip_index_point point;
+	size_t i;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "Could not open index file %s\n", path);
+		return -ENOENT;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GZIP_INDEX_MAGIC, sizeof(header.magic));
+	header.version = htole32(GZIP_INDEX_VERSION);
+	header.span = htole32(span);
+	header.compressed_size = htole64(gz.compressed_size);
+	header.uncompressed_size = htole64(gz.uncompressed_size);
+	header.points_count = htole64(gz.points_count);
+	header.records_count = htole64(gz.records_count);
+
+	if (fwrite(&header, sizeof(header), 1, f) != 1)
+		ret = -EIO;
+
+	for (i = 0; ret == 0 && i < gz.points_count; i++) {
+		memset(&point, 0, sizeof(point));
+		point.uncompressed_offset = htole64(gz.points[i].uncompressed_offset);
+		point.compressed_offset = htole64(gz.points[i].compressed_offset);
+		point.bits = gz.points[i].bits;
+
+		if (fwrite(&point, sizeof(point), 1, f) != 1 ||
+		    fwrite(gz.points[i].window, GZIP_WINDOW_SIZE, 1, f) != 1)
+			ret = -EIO;
+	}
+
+	for (i = 0; ret == 0 && i < gz.records_count; i++) {
+		record = gz.records[i];
+		record.offset = htole64(record.offset);
+		if (fwrite(&record, sizeof(record), 1, f) != 1)
+			ret = -EIO;
+	}
+
+	if (fclose(f) != 0)
+		ret = -EIO;
+
+	if (ret < 0)
+		fprintf(stderr, "Could not write index file %s\n", path);
+
+	return ret;
+}
+
+/* inflates the whole cache once and remembers the access points */
+int gzip_index_build(const char *path, uint64_t span)
+{
+	uint8_t *input, *window;
+	uint64_t total_in = 0, total_out = 0, last = 0;
+	uint8_t *out_start;
+	z_stream strm;
+	int zret = Z_OK;
+	int ret = 0;
+
+	if (span == 0 || span > UINT32_MAX) {
+		fprintf(stderr, "Invalid index span\n");
+		return -EINVAL;
+	}
+
+	input = malloc(GZIP_CHUNK_SIZE);
+	window = calloc(1, GZIP_WINDOW_SIZE);
+	if (!input || !window) {
+		free(window);
+		free(input);
+		return -ENOMEM;
+	}
+
+	/* the config header is not part of any file */
+	gz.next_header = sizeof(uint32_t);
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, 47) != Z_OK) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	do {
+		if (strm.avail_in == 0) {
+			strm.avail_in = (uInt)fread(input, 1, GZIP_CHUNK_SIZE, globals.in);
+			if (strm.avail_in == 0) {
+				fprintf(stderr, "Compressed input ended to early\n");
+				ret = -EIO;
+				break;
+			}
+			strm.next_in = input;
+		}
+
+		do {
+			if (strm.avail_out == 0) {
+				strm.avail_out = GZIP_WINDOW_SIZE;
+				strm.next_out = window;
+			}
+
+			out_start = strm.next_out;
+			total_in += strm.avail_in;
+			total_out += strm.avail_out;
+			zret = inflate(&strm, Z_BLOCK);
+			total_in -= strm.avail_in;
+			total_out -= strm.avail_out;
+
+			if (zret == Z_NEED_DICT || zret == Z_DATA_ERROR ||
+			    zret == Z_MEM_ERROR) {
+				fprintf(stderr, "Failure during decompressing\n");
+				ret = -EINVAL;
+				break;
+			}
+
+			ret = gzip_scan_records(out_start, (size_t)(strm.next_out - out_start),
+						total_out - (uint64_t)(strm.next_out - out_start));
+			if (ret < 0)
+				break;
+
+			if (zret == Z_STREAM_END)
+				break;
+
+			/* end of a deflate block which isn't the last one */
+			if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+			    (total_out == 0 || total_out - last >= span)) {
+				ret = gzip_add_point((uint8_t)(strm.data_type & 7),
+						     total_in, total_out,
+						     strm.avail_out, window);
+				if (ret < 0)
+					break;
+
+				last = total_out;
+			}
+		} while (strm.avail_in != 0);
+	} while (ret == 0 && zret != Z_STREAM_END);
+
+	inflateEnd(&strm);
+
+	if (ret < 0)
+		goto out;
+
+	if (gz.header_fill)
+		fprintf(stderr, "Last file header is truncated\n");
+
+	gz.compressed_size = total_in;
+	gz.uncompressed_size = total_out;
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Index: %zu access points, %zu files, %"PRIu64" bytes uncompressed\n",
+			gz.points_count, gz.records_count, gz.uncompressed_size);
+
+	ret = gzip_write_index(path, (uint32_t)span);
+
+out:
+	free(window);
+	free(input);
+
+	return ret;
+}
+
+static size_t gzip_span_length(size_t index)
+{
+	uint64_t end = gz.uncompressed_size;
+
+	if (index + 1 < gz.points_count)
+		end = gz.points[index + 1].uncompressed_offset;
+
+	return (size_t)(end - gz.points[index].uncompressed_offset);
+}
+
+static int gzip_pread(void *buffer, size_t size, uint64_t offset, size_t *len)
+{
+	ssize_t ret;
+
+	do {
+		ret = pread(gz.fd, buffer, size, (off_t)offset);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0)
+		return -EIO;
+
+	*len = (size_t)ret;
+
+	return 0;
+}
+
+/* restarts inflate at an access point - can run in several threads */
+static int gzip_inflate_span(size_t index, uint8_t *out)
+{
+	const struct gzip_point *point = &gz.points[index];
+	uint8_t input[GZIP_CHUNK_SIZE];
+	uint64_t offset = point->compressed_offset;
+	z_stream strm;
+	size_t len;
+	int zret;
+	int ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, -15) != Z_OK)
+		return -ENOMEM;
+
+	/* the access point can be in the middle of a byte */
+	if (point->bits) {
+		offset--;
+		ret = gzip_pread(input, 1, offset, &len);
+		if (ret < 0)
+			goto out;
+
+		offset++;
+		inflatePrime(&strm, point->bits, input[0] >> (8 - point->bits));
+	}
+
+	inflateSetDictionary(&strm, point->window, GZIP_WINDOW_SIZE);
+
+	strm.next_out = out;
+	strm.avail_out = (uInt)gzip_span_length(index);
+	ret = 0;
+
+	while (strm.avail_out > 0) {
+		if (strm.avail_in == 0) {
+			ret = gzip_pread(input, sizeof(input), offset, &len);
+			if (ret < 0)
+				break;
+
+			offset += len;
+			strm.next_in = input;
+			strm.avail_in = (uInt)len;
+		}
+
+		zret = inflate(&strm, Z_NO_FLUSH);
+		if (zret == Z_STREAM_END && strm.avail_out == 0)
+			break;
+
+		if (zret != Z_OK) {
+			ret = -EINVAL;
+			break;
+		}
+	}
+
+out:
+	inflateEnd(&strm);
+
+	return ret;
+}
+
+static void gzip_inflate_spans(size_t start, size_t end, void *ctx)
+{
+	size_t i;
+
+	(void)ctx;
+
+	for (i = start; i < end; i++)
+		gz.errors[i] = gzip_inflate_span(gz.first + i, gz.buffers[i]);
+}
+
+static int gzip_load_batch(size_t first)
+{
+	size_t i;
+
+	gz.first = first;
+	gz.loaded = gz.points_count - first;
+	if (gz.loaded > gz.batch)
+		gz.loaded = gz.batch;
+
+	parallel_for(gz.loaded, gzip_inflate_spans, NULL);
+
+	for (i = 0; i < gz.loaded; i++) {
+		if (gz.errors[i] < 0) {
+			fprintf(stderr, "Failed to decompress input at offset %"PRIu64"\n",
+				gz.points[first + i].uncompressed_offset);
+			gz.loaded = 0;
+			return gz.errors[i];
+		}
+	}
+
+	return 0;
+}
+
+static int gzip_prepare_span(size_t index)
+{
+	if (index >= gz.first && index < gz.first + gz.loaded)
+		return 0;
+
+	return gzip_load_batch(index);
+}
+
+static int gzip_next_chunk(const uint8_t **data, size_t *len)
+{
+	int ret;
+
+	if (gz.next >= gz.points_count) {
+		*data = NULL;
+		*len = 0;
+		return 0;
+	}
+
+	ret = gzip_prepare_span(gz.next);
+	if (ret < 0)
+		return ret;
+
+	*data = gz.buffers[gz.next - gz.first];
+	*len = gzip_span_length(gz.next);
+	gz.next++;
+
+	return 0;
+}
+
+static int gzip_seek(uint64_t offset, const uint8_t **data, size_t *len)
+{
+	size_t low = 0, high = gz.points_count, mid;
+	uint64_t skip;
+	int ret;
+
+	if (offset > gz.uncompressed_size)
+		return -EIO;
+
+	if (offset == gz.uncompressed_size) {
+		gz.next = gz.points_count;
+		*data = NULL;
+		*len = 0;
+		return 0;
+	}
+
+	/* last access point before the offset */
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (gz.points[mid].uncompressed_offset <= offset)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	ret = gzip_prepare_span(low);
+	if (ret < 0)
+		return ret;
+
+	skip = offset - gz.points[low].uncompressed_offset;
+	*data = gz.buffers[low - gz.first] + skip;
+	*len = gzip_span_length(low) - (size_t)skip;
+	gz.next = low + 1;
+
+	return 0;
+}
+
+static uint64_t gzip_size(void)
+{
+	return gz.uncompressed_size;
+}
+
+static const struct input_backend gzip_input = {
+	.next_chunk = gzip_next_chunk,
+	.seek = gzip_seek,
+	.size = gzip_size,
+};
+
+static int gzip_read_index(const char *path)
+{
+	struct gzip_index_header header;
+	struct gzip_index_point point;
+	struct stat st;
+	size_t i;
+	FILE *f;
+	int ret = -EINVAL;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Could not open index file %s\n", path);
+		return -ENOENT;
+	}
+
+	if (fstat(fileno(f), &st) < 0 ||
+	    fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, GZIP_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+	    le32toh(header.version) != GZIP_INDEX_VERSION)
+		goto err;
+
+	gz.compressed_size = le64toh(header.compressed_size);
+	gz.uncompressed_size = le64toh(header.uncompressed_size);
+	gz.points_count = le64toh(header.points_count);
+	gz.records_count = le64toh(header.records_count);
+
+	/* counts must match the size of the index before anything is allocated */
+	if (gz.points_count == 0 ||
+	    gz.points_count > (uint64_t)st.st_size / (sizeof(point) + GZIP_WINDOW_SIZE) ||
+	    gz.records_count > (uint64_t)st.st_size / sizeof(*gz.records) ||
+	    sizeof(header) + gz.points_count * (sizeof(point) + GZIP_WINDOW_SIZE) +
+	    gz.records_count * sizeof(*gz.records) != (uint64_t)st.st_size)
+		goto err;
+
+	ret = budget_reserve_static(gz.points_count * GZIP_WINDOW_SIZE +
+				    gz.records_count * sizeof(*gz.records));
+	if (ret < 0)
+		goto err;
+
+	ret = -ENOMEM;
+	gz.points = calloc(gz.points_count, sizeof(*gz.points));
+	gz.records = calloc(gz.records_count + 1, sizeof(*gz.records));
+	if (!gz.points || !gz.records)
+		goto err;
+
+	ret = -EINVAL;
+	for (i = 0; i < gz.points_count; i++) {
+		if (fread(&point, sizeof(point), 1, f) != 1)
+			goto err;
+
+		gz.points[i].uncompressed_offset = le64toh(point.uncompressed_offset);
+		gz.points[i].compressed_offset = le64toh(point.compressed_offset);
+		gz.points[i].bits = point.bits;
+
+		if (gz.points[i].bits > 7 ||
+		    gz.points[i].compressed_offset > gz.compressed_size ||
+		    gz.points[i].uncompressed_offset > gz.uncompressed_size ||
+		    (i == 0 && gz.points[i].uncompressed_offset != 0) ||
+		    (i > 0 && gz.points[i].uncompressed_offset <= gz.points[i - 1].uncompressed_offset))
+			goto err;
+
+		gz.points[i].window = malloc(GZIP_WINDOW_SIZE);
+		if (!gz.points[i].window) {
+			ret = -ENOMEM;
+			goto err;
+		}
+
+		if (fread(gz.points[i].window, GZIP_WINDOW_SIZE, 1, f) != 1)
+			goto err;
+	}
+
+	if (fread(gz.records, sizeof(*gz.records), gz.records_count, f) != gz.records_count)
+		goto err;
+
+	for (i = 0; i < gz.records_count; i++) {
+		gz.records[i].offset = le64toh(gz.records[i].offset);
+		if (gz.records[i].offset > gz.uncompressed_size)
+			goto err;
+	}
+
+	fclose(f);
+
+	return 0;
+
+err:
+	fclose(f);
+	fprintf(stderr, "Invalid index file %s\n", path);
+
+	return ret;
+}
+
+int gzip_index_input_init(const char *path)
+{
+	size_t i, longest = 0;
+	struct stat st;
+	int ret;
+
+	ret = gzip_read_index(path);
+	if (ret < 0)
+		return ret;
+
+	gz.fd = fileno(globals.in);
+	if (fstat(gz.fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (uint64_t)st.st_size != gz.compressed_size) {
+		fprintf(stderr, "Index %s doesn't belong to the compressed input\n", path);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < gz.points_count; i++) {
+		if (gzip_span_length(i) > longest)
+			longest = gzip_span_length(i);
+	}
+
+	/* one span per thread is inflated at the same time */
+	gz.batch = parallel_threads();
+	ret = budget_reserve_static((uint64_t)gz.batch * longest);
+	if (ret < 0)
+		return ret;
+
+	gz.buffers = calloc(gz.batch, sizeof(*gz.buffers));
+	gz.errors = calloc(gz.batch, sizeof(*gz.errors));
+	if (!gz.buffers || !gz.errors)
+		return -ENOMEM;
+
+	for (i = 0; i < gz.batch; i++) {
+		gz.buffers[i] = malloc(longest);
+		if (!gz.buffers[i])
+			return -ENOMEM;
+	}
+
+	input_set_backend(&gzip_input, 0);
+
+	return 0;
+}
+
+/* only files whose indexed header passes the filters are decompressed */
+int gzip_index_convert(void)
+{
+	struct gliden64_file file;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < gz.records_count; i++) {
+		parse_file_header(gz.records[i].header, &file);
+		if (!filter_match(&file))
+			continue;
+
+		ret = input_seek(gz.records[i].offset);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to seek to file at offset %#"PRIx64"\n",
+				gz.records[i].offset);
+			return ret;
+		}
+
+		ret = convert_file();
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int gzip_index_records(void)
+{
+	return globals.input_backend == &gzip_input && gz.records_count > 0;
+}
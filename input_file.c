@@ -5,18 +5,233 @@
  */
 
 #include "gliden64_cache_extract.h"
+#include "probes.h"
 #include <errno.h>
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <zlib.h>
 
-static int get_buffer(void *buffer, size_t size, int print_error)
+static struct {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	uint64_t offset;
+	int eof;
+} chunk;
+
+/* position in globals.in - ftell() costs a syscall per call */
+static struct {
+	FILE *file;
+	int valid;
+	uint64_t offset;
+} stream;
+
+/* size of globals.in when it is a regular file */
+static struct {
+	FILE *file;
+	uint64_t size;
+	int cached;
+} file_size;
+
+static void stream_advance(uint64_t size)
+{
+	if (stream.file == globals.in && stream.valid > 0)
+		stream.offset += size;
+}
+
+void input_set_backend(const struct input_backend *backend, uint64_t offset)
+{
+	globals.input_backend = backend;
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.offset = offset;
+}
+
+/* a new FILE can get the address of a closed one - its cached position and
+ * size must not be used for the new file
+ */
+void input_set_file(FILE *file)
+{
+	globals.in = file;
+	stream.file = NULL;
+	file_size.file = NULL;
+	input_set_backend(NULL, 0);
+}
+
+int input_eof(void)
+{
+	if (globals.input_backend)
+		return chunk.eof;
+
+	return feof(globals.in);
+}
+
+long input_tell(void)
+{
+	if (globals.input_backend)
+		return (long)chunk.offset;
+
+	if (stream.file != globals.in) {
+		off_t pos = ftello(globals.in);
+
+		stream.file = globals.in;
+		stream.valid = pos < 0 ? -1 : 1;
+		stream.offset = pos < 0 ? 0 : (uint64_t)pos;
+	}
+
+	if (stream.valid < 0)
+		return -1;
+
+	return (long)stream.offset;
+}
+
+/* size of a regular input file - fstat is only repeated when the cached
+ * size is too small, so growing files are still handled correctly
+ */
+static int input_file_size(uint64_t *size, uint64_t needed)
+{
+	struct stat st;
+
+	if (globals.input_backend && globals.input_backend->size) {
+		*size = globals.input_backend->size();
+		return 0;
+	}
+
+	if (file_size.file != globals.in) {
+		file_size.file = globals.in;
+		file_size.cached = 0;
+	}
+
+	if (file_size.cached == 1 && file_size.size >= needed) {
+		*size = file_size.size;
+		return 0;
+	}
+
+	if (file_size.cached < 0)
+		return -EOPNOTSUPP;
+
+	if (fstat(fileno(globals.in), &st) < 0 || !S_ISREG(st.st_mode)) {
+		file_size.cached = -1;
+		return -EOPNOTSUPP;
+	}
+
+	file_size.cached = 1;
+	file_size.size = (uint64_t)st.st_size;
+	*size = file_size.size;
+
+	return 0;
+}
+
+/* bytes left in the input (at least needed when possible) - only known
+ * for regular files
+ */
+int input_remaining(uint64_t *remaining, uint64_t needed)
+{
+	uint64_t size;
+	long pos;
+
+	pos = input_tell();
+	if (pos < 0 || input_file_size(&size, (uint64_t)pos + needed) < 0)
+		return -EOPNOTSUPP;
+
+	if ((uint64_t)pos > size)
+		*remaining = 0;
+	else
+		*remaining = size - (uint64_t)pos;
+
+	return 0;
+}
+
+/* moves the read position - inside of the buffered chunk or with the
+ * seek of the backend
+ */
+int input_seek(uint64_t offset)
+{
+	uint64_t start = chunk.offset - chunk.pos;
+	int ret;
+
+	if (!globals.input_backend)
+		return -EOPNOTSUPP;
+
+	if (offset >= start && offset <= start + chunk.len) {
+		chunk.pos = (size_t)(offset - start);
+		chunk.offset = offset;
+		return 0;
+	}
+
+	if (!globals.input_backend->seek)
+		return -EINVAL;
+
+	ret = globals.input_backend->seek(offset, &chunk.data, &chunk.len);
+	if (ret < 0)
+		return ret;
+
+	chunk.pos = 0;
+	chunk.offset = offset;
+	chunk.eof = chunk.len == 0;
+
+	return 0;
+}
+
+static int get_chunk_buffer(void *buffer, size_t size, int print_error)
+{
+	uint8_t *out = buffer;
+	size_t len;
+	int ret;
+
+	while (size > 0) {
+		if (chunk.pos == chunk.len) {
+			if (chunk.eof)
+				break;
+
+			ret = globals.input_backend->next_chunk(&chunk.data, &chunk.len);
+			if (ret < 0) {
+				if (print_error)
+					fprintf(stderr, "Error while reading input\n");
+				return ret;
+			}
+
+			chunk.pos = 0;
+			if (chunk.len == 0) {
+				chunk.eof = 1;
+				break;
+			}
+		}
+
+		len = chunk.len - chunk.pos;
+		if (len > size)
+			len = size;
+
+		memcpy(out, chunk.data + chunk.pos, len);
+		chunk.pos += len;
+		chunk.offset += len;
+		out += len;
+		size -= len;
+	}
+
+	if (size == 0)
+		return 0;
+
+	if (print_error)
+		fprintf(stderr, "File stream ended to early\n");
+
+	return -EIO;
+}
+
+int get_buffer(void *buffer, size_t size, int print_error)
 {
 	size_t ret;
 
+	if (globals.input_backend)
+		return get_chunk_buffer(buffer, size, print_error);
+
 	ret = fread(buffer, 1, size, globals.in);
+	stream_advance(ret);
 
 	if (ret == size)
 		return 0;
@@ -30,6 +245,153 @@ static int get_buffer(void *buffer, size_t size, int print_error)
 	return -EIO;
 }
 
+/* returns the number of bytes read before the end of the input */
+static size_t get_buffer_partial(void *buffer, size_t size)
+{
+	uint8_t *out = buffer;
+	size_t len, done = 0;
+
+	if (!globals.input_backend) {
+		done = fread(buffer, 1, size, globals.in);
+		stream_advance(done);
+		return done;
+	}
+
+	while (done < size) {
+		if (chunk.pos == chunk.len) {
+			if (chunk.eof)
+				break;
+
+			if (globals.input_backend->next_chunk(&chunk.data, &chunk.len) < 0) {
+				fprintf(stderr, "Error while reading input\n");
+				chunk.len = 0;
+				chunk.eof = 1;
+				break;
+			}
+
+			chunk.pos = 0;
+			if (chunk.len == 0) {
+				chunk.eof = 1;
+				break;
+			}
+		}
+
+		len = chunk.len - chunk.pos;
+		if (len > size - done)
+			len = size - done;
+
+		memcpy(out + done, chunk.data + chunk.pos, len);
+		chunk.pos += len;
+		chunk.offset += len;
+		done += len;
+	}
+
+	return done;
+}
+
+static int skip_chunk_buffer(uint64_t size, int print_error)
+{
+	size_t len;
+	int ret;
+
+	/* seekable backends don't have to produce the skipped data */
+	if (globals.input_backend->seek && size > chunk.len - chunk.pos) {
+		ret = input_seek(chunk.offset + size);
+		if (ret < 0 && print_error)
+			fprintf(stderr, "File stream ended to early\n");
+
+		return ret;
+	}
+
+	while (size > 0) {
+		if (chunk.pos == chunk.len) {
+			if (chunk.eof)
+				break;
+
+			ret = globals.input_backend->next_chunk(&chunk.data, &chunk.len);
+			if (ret < 0) {
+				if (print_error)
+					fprintf(stderr, "Error while reading input\n");
+				return ret;
+			}
+
+			chunk.pos = 0;
+			if (chunk.len == 0) {
+				chunk.eof = 1;
+				break;
+			}
+		}
+
+		len = chunk.len - chunk.pos;
+		if (len > size)
+			len = (size_t)size;
+
+		chunk.pos += len;
+		chunk.offset += len;
+		size -= len;
+	}
+
+	if (size == 0)
+		return 0;
+
+	if (print_error)
+		fprintf(stderr, "File stream ended to early\n");
+
+	return -EIO;
+}
+
+static int skip_stream_buffer(uint64_t size, int print_error)
+{
+	uint8_t buffer[64 * 1024];
+	size_t len;
+	int ret;
+
+	while (size > 0) {
+		len = sizeof(buffer);
+		if (len > size)
+			len = (size_t)size;
+
+		ret = get_buffer(buffer, len, print_error);
+		if (ret < 0)
+			return ret;
+
+		size -= len;
+	}
+
+	return 0;
+}
+
+/* skips data without copying it - seeks when the input allows it */
+int input_skip(uint64_t size, int print_error)
+{
+	uint64_t input_size;
+	long pos;
+
+	if (globals.input_backend)
+		return skip_chunk_buffer(size, print_error);
+
+	pos = input_tell();
+	if (pos < 0 || input_file_size(&input_size, (uint64_t)pos + size) < 0)
+		return skip_stream_buffer(size, print_error);
+
+	if ((uint64_t)pos + size > input_size) {
+		if (print_error)
+			fprintf(stderr, "File stream ended to early\n");
+		return -EIO;
+	}
+
+	/* a seek drops the stdio buffer - small skips are cheaper to read */
+	if (size < BUFSIZ)
+		return skip_stream_buffer(size, print_error);
+
+	if (fseeko(globals.in, (off_t)size, SEEK_CUR) < 0)
+		return skip_stream_buffer(size, print_error);
+
+	stream_advance(size);
+
+	return 0;
+}
+
 int get_buffer_endian(void *buffer, size_t size, int print_error)
 {
 	int ret;
@@ -60,58 +422,90 @@ int get_buffer_endian(void *buffer, size_t size, int print_error)
 	return 0;
 }
 
-int convert_file(void)
+static inline uint16_t load_le16(const uint8_t *data)
 {
-	struct gliden64_file file;
-	int ret;
-	long pos = ftell(globals.in);
+	uint16_t value;
 
-	ret = get_buffer_endian(&file.checksum, sizeof(file.checksum), 0);
-	if (ret < 0)
-		return 0;
+	memcpy(&value, data, sizeof(value));
+	return le16toh(value);
+}
 
-	ret = get_item(file.width);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read file width\n");
-		return ret;
-	}
+static inline uint32_t load_le32(const uint8_t *data)
+{
+	uint32_t value;
 
-	ret = get_item(file.height);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read file height\n");
-		return ret;
-	}
+	memcpy(&value, data, sizeof(value));
+	return le32toh(value);
+}
 
-	ret = get_item(file.format);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read file format\n");
-		return ret;
-	}
+static inline uint64_t load_le64(const uint8_t *data)
+{
+	uint64_t value;
 
-	ret = get_item(file.texture_format);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read file texture_format\n");
-		return ret;
-	}
+	memcpy(&value, data, sizeof(value));
+	return le64toh(value);
+}
 
-	ret = get_item(file.pixel_type);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read file pixel_type\n");
-		return ret;
-	}
+/* decodes the packed little endian header - the byte swaps are no-ops on
+ * little endian hosts and the loads are unaligned moves
+ */
+void parse_file_header(const uint8_t *header, struct gliden64_file *file)
+{
+	file->checksum = load_le64(header + 0);
+	file->width = load_le32(header + 8);
+	file->height = load_le32(header + 12);
+	file->format = load_le32(header + 16);
+	file->texture_format = load_le16(header + 20);
+	file->pixel_type = load_le16(header + 22);
+	file->is_hires_tex = header[24];
+	file->size = load_le32(header + 25);
+}
 
-	ret = get_item(file.is_hires_tex);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read file is_hires_tex\n");
-		return ret;
+/* returns 1 when the input ended before the next file header */
+int read_file_header(struct gliden64_file *file)
+{
+	uint8_t header[FILE_HEADER_SIZE];
+	size_t len;
+
+	/* parse directly from the input buffer when the header is complete */
+	if (globals.input_backend && chunk.len - chunk.pos >= sizeof(header)) {
+		parse_file_header(chunk.data + chunk.pos, file);
+		chunk.pos += sizeof(header);
+		chunk.offset += sizeof(header);
+		progress_read((long)chunk.offset);
+		return 0;
 	}
 
-	ret = get_item(file.size);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read filesize\n");
-		return ret;
+	len = get_buffer_partial(header, sizeof(header));
+	if (len == sizeof(header)) {
+		parse_file_header(header, file);
+		progress_read(input_tell());
+		return 0;
 	}
 
+	/* no further file when not even the checksum is available */
+	if (len < sizeof(file->checksum))
+		return 1;
+
+	fprintf(stderr, "Failed to read file header\n");
+
+	return -EIO;
+}
+
+int convert_file(void)
+{
+	struct gliden64_file file;
+	uint64_t remaining;
+	int ret;
+	long pos = input_tell();
+
+	if (globals.recover && !recover_header_plausible(pos))
+		return recover_resync(pos);
+
+	ret = read_file_header(&file);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	if (globals.verbose >= VERBOSITY_FILE_HEADER) {
 		if (pos >= 0 && globals.in != stdin)
 			fprintf(stderr, "Offset: %#lx\n", pos);
@@ -133,34 +527,97 @@ int convert_file(void)
 		return ret;
 	}
 
+	/* don't trust the header with allocations the input cannot back */
+	if (input_remaining(&remaining, file.size) == 0 && file.size > remaining) {
+		fprintf(stderr, "Filesize %"PRIu32" exceeds the remaining %"PRIu64" bytes of input\n",
+			file.size, remaining);
+		return -EINVAL;
+	}
+
+	if (!filter_match(&file)) {
+		progress_filtered();
+		ret = input_skip(file.size, 1);
+		if (ret < 0)
+			fprintf(stderr, "Failed to skip file content\n");
+
+		return ret;
+	}
+
+	PROBE5(file__start, file.checksum, file.width, file.height, file.format, file.size);
+
+	file.reserved = 0;
+	if (globals.max_memory) {
+		file.reserved = image_memory_estimate(&file);
+		ret = budget_reserve(file.reserved);
+		if (ret < 0) {
+			fprintf(stderr, "File needs %"PRIu64" bytes which exceeds the memory budget\n",
+				file.reserved);
+			PROBE4(file__done, file.checksum, file.format, 0, ret);
+			progress_failed();
+			if (!globals.ignore_error && !globals.recover)
+				return ret;
+
+			ret = input_skip(file.size, 1);
+			if (ret < 0)
+				fprintf(stderr, "Failed to skip file content\n");
+
+			return ret;
+		}
+	}
+
 	file.data = malloc(file.size);
 	if (!file.data) {
+		budget_release(file.reserved);
 		fprintf(stderr, "Could not allocate memory for file content\n");
 		return -ENOMEM;
 	}
 	ret = get_buffer(file.data, file.size, 1);
 	if (ret < 0) {
 		free(file.data);
+		budget_release(file.reserved);
 		fprintf(stderr, "Failed to read file content\n");
 		return ret;
 	}
 
+	if (globals.output_format == OUTPUT_DIR) {
+		file.payload_crc = (uint32_t)crc32(0, file.data, file.size);
+
+		if (globals.incremental && output_dir_unchanged(&file)) {
+			free(file.data);
+			budget_release(file.reserved);
+			PROBE4(file__done, file.checksum, file.format, 0, 0);
+			return 0;
+		}
+	}
+
 	ret = prepare_file(&file);
 	if (ret < 0) {
 		free(file.data);
+		budget_release(file.reserved);
 		fprintf(stderr, "Failed to prepare file for export\n");
-		if (globals.ignore_error)
+		PROBE4(file__done, file.checksum, file.format, 0, ret);
+		progress_failed();
+		if (globals.ignore_error || globals.recover)
 			return 0;
 		else
 			return ret;
 	}
 
-	ret = write_file(&file);
+	if (globals.atlas_columns)
+		ret = atlas_add(&file);
+	else
+		ret = write_file(&file);
+	PROBE4(file__done, file.checksum, file.format, file.size, ret);
 	free(file.data);
+	/* sharded output releases it when the queued file was written */
+	if (file.reserved)
+		budget_release(file.reserved);
 	if (ret < 0) {
 		fprintf(stderr, "Could not write file content\n");
 		return ret;
 	}
 
+	progress_written(file.size);
+
 	return 0;
 }
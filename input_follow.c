@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * The follow backend never reports the end of a regular input file while the
+ * file can still grow. A read at the end of the file waits for inotify events
+ * of the file instead and continues at the same offset afterwards - so a
+ * partially written file is completed with the data appended later.
+ *
+ * SIGINT and SIGTERM stop the waiting. The input then ends at the last
+ * complete file and the output is finished normally.
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FOLLOW_BUFFER_SIZE (1024 * 1024)
+/* signals can be delivered to other threads - poll doesn't return then */
+#define FOLLOW_POLL_TIMEOUT 1000
+
+static struct {
+	int fd;
+	int inotify_fd;
+	uint8_t *buffer;
+	uint64_t offset;
+} follow = {
+	.fd = -1,
+	.inotify_fd = -1,
+};
+
+static volatile sig_atomic_t follow_stop;
+
+static void follow_signal(int sig)
+{
+	(void)sig;
+
+	follow_stop = 1;
+}
+
+static int follow_wait(void)
+{
+	uint8_t events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd;
+	struct stat st;
+	int ret;
+
+	/* the files of the last burst shouldn't wait in the output buffer */
+	ret = output_flush();
+	if (ret < 0)
+		return ret;
+
+	if (fstat(follow.fd, &st) < 0)
+		return -errno;
+
+	if ((uint64_t)st.st_size < follow.offset) {
+		fprintf(stderr, "Followed input file was truncated\n");
+		return -EIO;
+	}
+
+	/* data was appended between the read and the fstat */
+	if ((uint64_t)st.st_size > follow.offset)
+		return 0;
+
+	pfd.fd = follow.inotify_fd;
+	pfd.events = POLLIN;
+	ret = poll(&pfd, follow.inotify_fd >= 0 ? 1 : 0, FOLLOW_POLL_TIMEOUT);
+	if (ret < 0 && errno != EINTR)
+		return -errno;
+
+	/* only the wakeup is of interest - the events are dropped */
+	if (ret > 0 && read(follow.inotify_fd, events, sizeof(events)) < 0 &&
+	    errno != EINTR && errno != EAGAIN)
+		return -errno;
+
+	return 0;
+}
+
+static int follow_next_chunk(const uint8_t **data, size_t *len)
+{
+	int waiting = 0;
+	ssize_t ret;
+	int err;
+
+	while (1) {
+		ret = read(follow.fd, follow.buffer, FOLLOW_BUFFER_SIZE);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0)
+			return -errno;
+
+		if (ret > 0) {
+			follow.offset += (uint64_t)ret;
+			*data = follow.buffer;
+			*len = (size_t)ret;
+			return 0;
+		}
+
+		if (follow_stop) {
+			*data = NULL;
+			*len = 0;
+			return 0;
+		}
+
+		if (!waiting && globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+			fprintf(stderr, "Waiting for input at offset %#"PRIx64"\n",
+				follow.offset);
+		waiting = 1;
+
+		err = follow_wait();
+		if (err < 0)
+			return err;
+	}
+}
+
+/* the end of a growing file isn't known - no file header can be rejected
+ * because its content wasn't written yet
+ */
+static uint64_t follow_size(void)
+{
+	return UINT64_MAX;
+}
+
+static const struct input_backend follow_input = {
+	.next_chunk = follow_next_chunk,
+	.size = follow_size,
+};
+
+int follow_input_init(void)
+{
+	struct sigaction sa;
+	struct stat st;
+	off_t pos;
+	int ret;
+
+	follow.fd = fileno(globals.in);
+	if (fstat(follow.fd, &st) < 0)
+		return -errno;
+
+	if (!S_ISREG(st.st_mode)) {
+		fprintf(stderr, "--follow requires a regular input file\n");
+		return -EINVAL;
+	}
+
+	pos = lseek(follow.fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return -errno;
+
+	ret = budget_reserve_static(FOLLOW_BUFFER_SIZE);
+	if (ret < 0)
+		return ret;
+
+	follow.buffer = malloc(FOLLOW_BUFFER_SIZE);
+	if (!follow.buffer)
+		return -ENOMEM;
+
+	/* without inotify the file is checked every FOLLOW_POLL_TIMEOUT ms */
+	follow.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (follow.inotify_fd >= 0) {
+		char path[64];
+
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", follow.fd);
+		if (inotify_add_watch(follow.inotify_fd, path,
+				      IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB) < 0) {
+			close(follow.inotify_fd);
+			follow.inotify_fd = -1;
+		}
+	}
+
+	if (follow.inotify_fd < 0 && globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "inotify not available, polling the input file\n");
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = follow_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	follow.offset = (uint64_t)pos;
+	input_set_backend(&follow_input, (uint64_t)pos);
+
+	return 0;
+}
+
+/* the input ended because of a signal and not with the file */
+int follow_stopped(void)
+{
+	return globals.input_backend == &follow_input && follow_stop;
+}
+#else
+int follow_input_init(void)
+{
+	fprintf(stderr, "--follow is not supported on this platform\n");
+	return -EOPNOTSUPP;
+}
+
+int follow_stopped(void)
+{
+	return 0;
+}
+#endif
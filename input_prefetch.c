@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PREFETCH_BUFFERS 4
+#define PREFETCH_BUFFER_SIZE (1024 * 1024)
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd;
+	uint8_t *buffers[PREFETCH_BUFFERS];
+	size_t length[PREFETCH_BUFFERS];
+	unsigned int filled;
+	unsigned int consumed;
+	int holding;
+	int eof;
+	int error;
+} prefetch = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *prefetch_thread(void *arg)
+{
+	unsigned int index;
+	uint8_t *buffer;
+	size_t len;
+	ssize_t ret;
+	int eof = 0;
+	int error = 0;
+
+	(void)arg;
+
+	while (!eof && !error) {
+		pthread_mutex_lock(&prefetch.lock);
+		while (prefetch.filled - prefetch.consumed == PREFETCH_BUFFERS)
+			pthread_cond_wait(&prefetch.cond, &prefetch.lock);
+		pthread_mutex_unlock(&prefetch.lock);
+
+		/* the buffer is owned by this thread until filled is increased */
+		index = prefetch.filled % PREFETCH_BUFFERS;
+		buffer = prefetch.buffers[index];
+		len = 0;
+		while (len < PREFETCH_BUFFER_SIZE) {
+			ret = read(prefetch.fd, buffer + len, PREFETCH_BUFFER_SIZE - len);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret < 0) {
+				error = 1;
+				break;
+			}
+
+			if (ret == 0) {
+				eof = 1;
+				break;
+			}
+
+			len += (size_t)ret;
+		}
+
+		pthread_mutex_lock(&prefetch.lock);
+		prefetch.length[index] = len;
+		if (len > 0)
+			prefetch.filled++;
+		prefetch.eof = eof;
+		prefetch.error = error;
+		pthread_cond_broadcast(&prefetch.cond);
+		pthread_mutex_unlock(&prefetch.lock);
+	}
+
+	return NULL;
+}
+
+static int prefetch_next_chunk(const uint8_t **data, size_t *len)
+{
+	unsigned int index;
+
+	pthread_mutex_lock(&prefetch.lock);
+	if (prefetch.holding) {
+		prefetch.consumed++;
+		prefetch.holding = 0;
+		pthread_cond_broadcast(&prefetch.cond);
+	}
+
+	while (prefetch.filled == prefetch.consumed && !prefetch.eof &&
+	       !prefetch.error)
+		pthread_cond_wait(&prefetch.cond, &prefetch.lock);
+
+	if (prefetch.filled == prefetch.consumed) {
+		pthread_mutex_unlock(&prefetch.lock);
+		*data = NULL;
+		*len = 0;
+
+		if (prefetch.error)
+			return -EIO;
+
+		return 0;
+	}
+
+	index = prefetch.consumed % PREFETCH_BUFFERS;
+	*data = prefetch.buffers[index];
+	*len = prefetch.length[index];
+	prefetch.holding = 1;
+	pthread_mutex_unlock(&prefetch.lock);
+
+	return 0;
+}
+
+static const struct input_backend prefetch_input = {
+	.next_chunk = prefetch_next_chunk,
+};
+
+int prefetch_input_init(void)
+{
+	unsigned int i;
+	struct stat st;
+	int ret;
+
+	prefetch.fd = fileno(globals.in);
+	if (fstat(prefetch.fd, &st) < 0)
+		return -errno;
+
+	/* regular files are already read ahead by the kernel */
+	if (S_ISREG(st.st_mode))
+		return -EOPNOTSUPP;
+
+	ret = budget_reserve_static((uint64_t)PREFETCH_BUFFERS * PREFETCH_BUFFER_SIZE);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < PREFETCH_BUFFERS; i++) {
+		prefetch.buffers[i] = malloc(PREFETCH_BUFFER_SIZE);
+		if (!prefetch.buffers[i]) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	ret = pthread_create(&prefetch.thread, NULL, prefetch_thread, NULL);
+	if (ret != 0) {
+		ret = -ret;
+		goto err;
+	}
+
+	pthread_detach(prefetch.thread);
+	input_set_backend(&prefetch_input, 0);
+
+	return 0;
+
+err:
+	for (i = 0; i < PREFETCH_BUFFERS; i++) {
+		free(prefetch.buffers[i]);
+		prefetch.buffers[i] = NULL;
+	}
+
+	budget_release_static((uint64_t)PREFETCH_BUFFERS * PREFETCH_BUFFER_SIZE);
+
+	return ret;
+}
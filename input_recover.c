@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef __WIN32__
+#include <sys/mman.h>
+#endif
+
+#define RECOVER_MAX_DIMENSION 16384
+
+static struct {
+	const uint8_t *data;
+	size_t len;
+	int delivered;
+} recover;
+
+static int recover_next_chunk(const uint8_t **data, size_t *len)
+{
+	if (recover.delivered) {
+		*data = NULL;
+		*len = 0;
+		return 0;
+	}
+
+	recover.delivered = 1;
+	*data = recover.data;
+	*len = recover.len;
+
+	return 0;
+}
+
+static const struct input_backend recover_input = {
+	.next_chunk = recover_next_chunk,
+};
+
+static int recover_slurp(int fd)
+{
+	size_t capacity = 1024 * 1024;
+	uint8_t *buf, *new_buf;
+	size_t len = 0;
+	ssize_t ret;
+
+	if (budget_reserve_static(capacity) < 0)
+		return -ENOMEM;
+
+	buf = malloc(capacity);
+	if (!buf)
+		return -ENOMEM;
+
+	for (;;) {
+		if (len == capacity) {
+			if (budget_reserve_static(capacity) < 0) {
+				free(buf);
+				return -ENOMEM;
+			}
+
+			capacity *= 2;
+			new_buf = realloc(buf, capacity);
+			if (!new_buf) {
+				free(buf);
+				return -ENOMEM;
+			}
+			buf = new_buf;
+		}
+
+		ret = read(fd, buf + len, capacity - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0) {
+			free(buf);
+			return -EIO;
+		}
+
+		if (ret == 0)
+			break;
+
+		len += (size_t)ret;
+	}
+
+	recover.data = buf;
+	recover.len = len;
+
+	return 0;
+}
+
+/* damaged caches are scanned in memory - regular files are mapped, pipes
+ * have to be read completely first
+ */
+int recover_input_init(void)
+{
+	struct stat st;
+	int fd = fileno(globals.in);
+	int ret;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+#ifndef __WIN32__
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map;
+
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			recover.data = map;
+			recover.len = (size_t)st.st_size;
+			input_set_backend(&recover_input, 0);
+
+			return 0;
+		}
+	}
+#endif
+
+	ret = recover_slurp(fd);
+	if (ret < 0)
+		return ret;
+
+	input_set_backend(&recover_input, 0);
+
+	return 0;
+}
+
+static int recover_zlib_header(const uint8_t *data)
+{
+	uint32_t cmf = data[0];
+	uint32_t flg = data[1];
+
+	return (cmf & 0x0f) == 8 && (cmf >> 4) <= 7 && ((cmf << 8) | flg) % 31 == 0;
+}
+
+/* checks whether a record header at offset could be valid */
+static int recover_plausible(size_t offset)
+{
+	const uint8_t *header = recover.data + offset;
+	struct gliden64_file file;
+	uint64_t expected_size;
+	size_t remaining;
+
+	if (offset > recover.len || recover.len - offset < FILE_HEADER_SIZE)
+		return 0;
+
+	remaining = recover.len - offset - FILE_HEADER_SIZE;
+
+	parse_file_header(header, &file);
+
+	if (file.width == 0 || file.width > RECOVER_MAX_DIMENSION ||
+	    file.height == 0 || file.height > RECOVER_MAX_DIMENSION)
+		return 0;
+
+	if (file.is_hires_tex > 1)
+		return 0;
+
+	switch (file.format & ~GR_TEXFMT_GZ) {
+	case GR_RGBA8:
+		expected_size = (uint64_t)file.width * file.height * 4;
+		break;
+	case GR_RGB:
+	case GR_RGBA4:
+	case GR_RGB5_A1:
+		expected_size = (uint64_t)file.width * file.height * 2;
+		break;
+	default:
+		return 0;
+	}
+
+	if (file.size == 0 || file.size > remaining)
+		return 0;
+
+	if (!(file.format & GR_TEXFMT_GZ))
+		return file.size == expected_size;
+
+	/* deflate can only grow incompressible data by a few bytes */
+	if (file.size < 2 || file.size > expected_size + expected_size / 1000 + 64)
+		return 0;
+
+	return recover_zlib_header(header + FILE_HEADER_SIZE);
+}
+
+/* the format field is the most selective part of the header: its second
+ * byte is 0x80 (GR_RGBA8, GR_RGBA4, GR_RGB5_A1) or 0x19 (GR_RGB). memchr
+ * is vectorized in the usual C libraries and finds these candidates fast
+ */
+static int recover_scan(size_t from, size_t *found)
+{
+	const uint8_t *next_80 = NULL, *next_19 = NULL;
+	const uint8_t *pos, *end, *candidate;
+	struct gliden64_file file;
+	size_t offset, next;
+
+	if (recover.len < FILE_HEADER_SIZE ||
+	    from > recover.len - FILE_HEADER_SIZE)
+		return -ENOENT;
+
+	pos = recover.data + from + 17;
+	end = recover.data + recover.len - FILE_HEADER_SIZE + 17 + 1;
+
+	/* a byte which doesn't occur anymore is remembered as end - the rest
+	 * of the buffer isn't searched again for it
+	 */
+	while (pos < end) {
+		if (!next_80 || next_80 < pos) {
+			next_80 = memchr(pos, 0x80, (size_t)(end - pos));
+			if (!next_80)
+				next_80 = end;
+		}
+		if (!next_19 || next_19 < pos) {
+			next_19 = memchr(pos, 0x19, (size_t)(end - pos));
+			if (!next_19)
+				next_19 = end;
+		}
+
+		candidate = next_80 < next_19 ? next_80 : next_19;
+		if (candidate == end)
+			break;
+
+		offset = (size_t)(candidate - recover.data) - 17;
+		if (recover_plausible(offset)) {
+			/* a following record (or the end) makes false positives
+			 * inside of payload data unlikely
+			 */
+			parse_file_header(recover.data + offset, &file);
+			next = offset + FILE_HEADER_SIZE + file.size;
+			if (next == recover.len || recover_plausible(next)) {
+				*found = offset;
+				return 0;
+			}
+		}
+
+		pos = candidate + 1;
+	}
+
+	return -ENOENT;
+}
+
+int recover_header_plausible(long offset)
+{
+	/* the end of the input is handled by the normal EOF detection */
+	if (offset < 0 || (size_t)offset >= recover.len)
+		return 1;
+
+	return recover_plausible((size_t)offset);
+}
+
+int recover_resync(long offset)
+{
+	size_t found;
+	int ret;
+
+	if (offset < 0)
+		return -EINVAL;
+
+	ret = recover_scan((size_t)offset + 1, &found);
+	if (ret < 0) {
+		fprintf(stderr, "Recover: no further record found after offset %#lx, skipping %zu bytes\n",
+			offset, recover.len - (size_t)offset);
+		found = recover.len;
+	} else {
+		fprintf(stderr, "Recover: skipped %zu damaged bytes at offset %#lx\n",
+			found - (size_t)offset, offset);
+	}
+
+	return input_seek((uint64_t)found);
+}
@@ -0,0 +1,539 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <stdio.h>
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+#define URING_BUFFERS 8
+#define URING_BUFFER_SIZE (256 * 1024)
+
+struct uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int entries;
+	unsigned int to_submit;
+	int fixed;
+};
+
+static int uring_setup(struct uring *ring, unsigned int entries,
+		       uint8_t *buffers[], size_t buffer_size)
+{
+	struct iovec iov[URING_BUFFERS];
+	struct io_uring_params p;
+	size_t sq_ring_size, cq_ring_size;
+	void *sq_ring = MAP_FAILED, *cq_ring = MAP_FAILED, *sqes;
+	unsigned int i;
+	long ret;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	ret = syscall(__NR_io_uring_setup, entries, &p);
+	if (ret < 0)
+		return -errno;
+
+	ring->fd = (int)ret;
+	ring->entries = p.sq_entries;
+
+	sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_ring_size > sq_ring_size)
+			sq_ring_size = cq_ring_size;
+		cq_ring_size = sq_ring_size;
+	}
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+		goto err;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, ring->fd,
+			       IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED)
+			goto err;
+	}
+
+	sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring->fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto err;
+
+	ring->sq_head = (unsigned int *)((uint8_t *)sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)((uint8_t *)sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)((uint8_t *)sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)((uint8_t *)sq_ring + p.sq_off.array);
+	ring->cq_head = (unsigned int *)((uint8_t *)cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)((uint8_t *)cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)((uint8_t *)cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((uint8_t *)cq_ring + p.cq_off.cqes);
+	ring->sqes = sqes;
+
+	/* registered buffers save the page pinning on each request but can
+	 * fail because of RLIMIT_MEMLOCK - plain requests still work then
+	 */
+	for (i = 0; i < URING_BUFFERS; i++) {
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len = buffer_size;
+	}
+
+	ret = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+		      iov, URING_BUFFERS);
+	ring->fixed = (ret >= 0);
+
+	return 0;
+
+err:
+	ret = -errno;
+	if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_size);
+	if (sq_ring != MAP_FAILED)
+		munmap(sq_ring, sq_ring_size);
+	close(ring->fd);
+	return (int)ret;
+}
+
+static void uring_prep_rw(struct uring *ring, uint8_t op, int fd,
+			  unsigned int buf_index, void *buffer, size_t len,
+			  uint64_t offset, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, index;
+
+	tail = *ring->sq_tail;
+	index = tail & *ring->sq_mask;
+	sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = (uint32_t)len;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	if (ring->fixed)
+		sqe->buf_index = (uint16_t)buf_index;
+
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+}
+
+/* starts the prepared requests without waiting - the I/O overlaps with the
+ * parsing and encoding then. A failure leaves them prepared and
+ * uring_wait() submits them again and reports the error
+ */
+static void uring_submit(struct uring *ring)
+{
+	long ret;
+
+	while (ring->to_submit > 0) {
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 0, 0,
+			      NULL, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		ring->to_submit -= (unsigned int)ret;
+	}
+}
+
+static int uring_wait(struct uring *ring, struct io_uring_cqe *cqe)
+{
+	unsigned int head, tail;
+	long ret;
+
+	for (;;) {
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		if (head != tail) {
+			*cqe = ring->cqes[head & *ring->cq_mask];
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+			return 0;
+		}
+
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		ring->to_submit -= (unsigned int)ret;
+	}
+}
+
+static struct {
+	struct uring ring;
+	int fd;
+	uint8_t *buffers[URING_BUFFERS];
+	size_t length[URING_BUFFERS];
+	int done[URING_BUFFERS];
+	uint64_t offset[URING_BUFFERS];
+	uint64_t next_offset;
+	uint64_t file_size;
+	unsigned int head;
+	unsigned int submitted;
+	int holding;
+} uin;
+
+static void uring_input_submit(void)
+{
+	unsigned int index = uin.submitted % URING_BUFFERS;
+	uint64_t remaining = uin.file_size - uin.next_offset;
+	size_t len = URING_BUFFER_SIZE;
+
+	if (len > remaining)
+		len = (size_t)remaining;
+
+	uin.offset[index] = uin.next_offset;
+	uin.length[index] = len;
+	uin.done[index] = 0;
+	uring_prep_rw(&uin.ring, uin.ring.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ,
+		      uin.fd, index, uin.buffers[index], len, uin.next_offset,
+		      index);
+
+	uin.next_offset += len;
+	uin.submitted++;
+}
+
+static int uring_input_next_chunk(const uint8_t **data, size_t *len)
+{
+	struct io_uring_cqe cqe;
+	unsigned int index;
+	size_t got;
+	ssize_t ret;
+	int err;
+
+	if (uin.holding) {
+		uin.head++;
+		uin.holding = 0;
+		if (uin.next_offset < uin.file_size) {
+			uring_input_submit();
+			uring_submit(&uin.ring);
+		}
+	}
+
+	if (uin.head == uin.submitted) {
+		*data = NULL;
+		*len = 0;
+		return 0;
+	}
+
+	index = uin.head % URING_BUFFERS;
+	while (!uin.done[index]) {
+		err = uring_wait(&uin.ring, &cqe);
+		if (err < 0)
+			return err;
+
+		if (cqe.res < 0) {
+			fprintf(stderr, "io_uring read failed: %s\n", strerror(-cqe.res));
+			return -EIO;
+		}
+
+		uin.done[cqe.user_data] = 1;
+		got = (size_t)cqe.res;
+
+		/* short reads are completed synchronously to keep the chunks
+		 * contiguous for the parser
+		 */
+		while (got < uin.length[cqe.user_data]) {
+			ret = pread(uin.fd, uin.buffers[cqe.user_data] + got,
+				    uin.length[cqe.user_data] - got,
+				    (off_t)(uin.offset[cqe.user_data] + got));
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0)
+				return -EIO;
+			if (ret == 0)
+				break;
+			got += (size_t)ret;
+		}
+		uin.length[cqe.user_data] = got;
+	}
+
+	uin.holding = 1;
+	*data = uin.buffers[index];
+	*len = uin.length[index];
+
+	return 0;
+}
+
+static const struct input_backend uring_input = {
+	.next_chunk = uring_input_next_chunk,
+};
+
+/* the caller falls back to stdio - the buffers are returned to the budget */
+static void uring_free_buffers(uint8_t *buffers[])
+{
+	unsigned int i;
+
+	for (i = 0; i < URING_BUFFERS; i++) {
+		free(buffers[i]);
+		buffers[i] = NULL;
+	}
+
+	budget_release_static((uint64_t)URING_BUFFERS * URING_BUFFER_SIZE);
+}
+
+static int uring_alloc_buffers(uint8_t *buffers[])
+{
+	unsigned int i;
+	int ret;
+
+	ret = budget_reserve_static((uint64_t)URING_BUFFERS * URING_BUFFER_SIZE);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < URING_BUFFERS; i++) {
+		buffers[i] = malloc(URING_BUFFER_SIZE);
+		if (!buffers[i]) {
+			uring_free_buffers(buffers);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+int io_uring_input_init(void)
+{
+	struct stat st;
+	long pos;
+	int ret;
+
+	uin.fd = fileno(globals.in);
+	if (fstat(uin.fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -EOPNOTSUPP;
+
+	pos = ftell(globals.in);
+	if (pos < 0)
+		return -EOPNOTSUPP;
+
+	ret = uring_alloc_buffers(uin.buffers);
+	if (ret < 0)
+		return ret;
+
+	ret = uring_setup(&uin.ring, URING_BUFFERS, uin.buffers, URING_BUFFER_SIZE);
+	if (ret < 0) {
+		uring_free_buffers(uin.buffers);
+		return ret;
+	}
+
+	uin.next_offset = (uint64_t)pos;
+	uin.file_size = (uint64_t)st.st_size;
+	while (uin.submitted < URING_BUFFERS && uin.next_offset < uin.file_size)
+		uring_input_submit();
+	uring_submit(&uin.ring);
+
+	input_set_backend(&uring_input, (uint64_t)pos);
+
+	return 0;
+}
+
+static struct {
+	struct uring ring;
+	int fd;
+	uint8_t *buffers[URING_BUFFERS];
+	size_t length[URING_BUFFERS];
+	uint64_t offset[URING_BUFFERS];
+	int busy[URING_BUFFERS];
+	unsigned int current;
+	unsigned int inflight;
+	uint64_t next_offset;
+} uout;
+
+static int uring_output_reap(void)
+{
+	struct io_uring_cqe cqe;
+	unsigned int index;
+	size_t written;
+	ssize_t ret;
+	int err;
+
+	err = uring_wait(&uout.ring, &cqe);
+	if (err < 0)
+		return err;
+
+	index = (unsigned int)cqe.user_data;
+	uout.busy[index] = 0;
+	uout.inflight--;
+
+	if (cqe.res < 0) {
+		fprintf(stderr, "io_uring write failed: %s\n", strerror(-cqe.res));
+		return -EIO;
+	}
+
+	written = (size_t)cqe.res;
+	while (written < uout.length[index]) {
+		ret = pwrite(uout.fd, uout.buffers[index] + written,
+			     uout.length[index] - written,
+			     (off_t)(uout.offset[index] + written));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -EIO;
+		written += (size_t)ret;
+	}
+
+	return 0;
+}
+
+static void uring_output_submit(void)
+{
+	unsigned int index = uout.current;
+
+	uout.offset[index] = uout.next_offset;
+	uout.busy[index] = 1;
+	uout.inflight++;
+	uring_prep_rw(&uout.ring, uout.ring.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+		      uout.fd, index, uout.buffers[index], uout.length[index],
+		      uout.next_offset, index);
+
+	uout.next_offset += uout.length[index];
+	uout.current = (uout.current + 1) % URING_BUFFERS;
+	uout.length[uout.current] = 0;
+	uring_submit(&uout.ring);
+}
+
+static int uring_output_write(const void *buffer, size_t size)
+{
+	const uint8_t *in = buffer;
+	unsigned int index;
+	size_t len;
+	int ret;
+
+	while (size > 0) {
+		index = uout.current;
+		while (uout.busy[index]) {
+			ret = uring_output_reap();
+			if (ret < 0)
+				return ret;
+		}
+
+		len = URING_BUFFER_SIZE - uout.length[index];
+		if (len > size)
+			len = size;
+
+		memcpy(uout.buffers[index] + uout.length[index], in, len);
+		uout.length[index] += len;
+		in += len;
+		size -= len;
+
+		if (uout.length[index] == URING_BUFFER_SIZE)
+			uring_output_submit();
+	}
+
+	return 0;
+}
+
+static int uring_output_flush(void)
+{
+	int ret;
+
+	if (uout.length[uout.current] > 0)
+		uring_output_submit();
+
+	while (uout.inflight > 0) {
+		ret = uring_output_reap();
+		if (ret < 0)
+			return ret;
+	}
+
+	if (lseek(uout.fd, (off_t)uout.next_offset, SEEK_SET) < 0)
+		return -EIO;
+
+	return 0;
+}
+
+static const struct output_backend uring_output = {
+	.write = uring_output_write,
+	.flush = uring_output_flush,
+};
+
+int io_uring_output_init(void)
+{
+	struct stat st;
+	off_t pos;
+	int ret;
+
+	if (fflush(globals.out) != 0)
+		return -EIO;
+
+	uout.fd = fileno(globals.out);
+	if (fstat(uout.fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -EOPNOTSUPP;
+
+	pos = lseek(uout.fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return -EOPNOTSUPP;
+
+	ret = uring_alloc_buffers(uout.buffers);
+	if (ret < 0)
+		return ret;
+
+	ret = uring_setup(&uout.ring, URING_BUFFERS, uout.buffers, URING_BUFFER_SIZE);
+	if (ret < 0) {
+		uring_free_buffers(uout.buffers);
+		return ret;
+	}
+
+	uout.next_offset = (uint64_t)pos;
+	globals.output_backend = &uring_output;
+
+	return 0;
+}
+
+#else /* HAVE_IO_URING */
+
+int io_uring_input_init(void)
+{
+	return -EOPNOTSUPP;
+}
+
+int io_uring_output_init(void)
+{
+	return -EOPNOTSUPP;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * The memfd output connects to a SOCK_SEQPACKET unix socket of a consumer.
+ * The top-down BGRA_8888 pixels of the textures are collected in sealed
+ * memfd batches. Each batch is sent as one message (host byte order):
+ *
+ *   struct memfd_batch_header
+ *   struct memfd_batch_entry for each texture of the batch
+ *
+ * with the memfd attached as SCM_RIGHTS. The pixels of a texture start at
+ * its offset in the memfd, which is always a multiple of 64. A message
+ * without textures and without a descriptor ends the output.
+ *
+ * The seals forbid any further modification - consumers can mmap the memfd
+ * read-only and use the pixels without any copy or parsing.
+ */
+
+#define _GNU_SOURCE
+#include "gliden64_cache_extract.h"
+#include "probes.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MEMFD_MAGIC "GLN64FD"
+#define MEMFD_VERSION 1
+#define MEMFD_BATCH_FILES 1024
+#define MEMFD_ALIGNMENT 64
+
+struct memfd_batch_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t size;
+};
+
+struct memfd_batch_entry {
+	uint64_t checksum;
+	uint64_t offset;
+	uint32_t size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t source_format;
+};
+
+static struct {
+	int socket;
+	int fd;
+	uint8_t *map;
+	uint64_t capacity;
+	uint64_t used;
+	uint32_t count;
+	struct memfd_batch_entry entries[MEMFD_BATCH_FILES];
+} memfd_output = {
+	.socket = -1,
+	.fd = -1,
+};
+
+int memfd_output_init(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+	int ret;
+
+	if (strlen(globals.memfd_socket) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", globals.memfd_socket);
+		return -ENAMETOOLONG;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, globals.memfd_socket);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ret = -errno;
+		fprintf(stderr, "Could not connect to %s\n", globals.memfd_socket);
+		close(fd);
+		return ret;
+	}
+
+	memfd_output.socket = fd;
+
+	return 0;
+}
+
+static int memfd_batch_open(uint64_t size)
+{
+	uint64_t capacity = globals.memfd_batch_size;
+	int fd;
+	int ret;
+
+	if (capacity < size)
+		capacity = size;
+
+	fd = memfd_create("gliden64-textures", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+
+	/* tmpfs only allocates the pages which are written */
+	if (ftruncate(fd, (off_t)capacity) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	memfd_output.map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (memfd_output.map == MAP_FAILED) {
+		ret = -errno;
+		memfd_output.map = NULL;
+		close(fd);
+		return ret;
+	}
+
+	memfd_output.fd = fd;
+	memfd_output.capacity = capacity;
+	memfd_output.used = 0;
+	memfd_output.count = 0;
+
+	return 0;
+}
+
+static int memfd_send(const struct memfd_batch_header *header, int fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov[2];
+	ssize_t ret;
+
+	iov[0].iov_base = (void *)header;
+	iov[0].iov_len = sizeof(*header);
+	iov[1].iov_base = memfd_output.entries;
+	iov[1].iov_len = header->count * sizeof(memfd_output.entries[0]);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = header->count ? 2 : 1;
+
+	if (fd >= 0) {
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	do {
+		ret = sendmsg(memfd_output.socket, &msg, MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		ret = -errno;
+		fprintf(stderr, "Could not send textures to %s\n", globals.memfd_socket);
+		return (int)ret;
+	}
+
+	return 0;
+}
+
+static void memfd_header(struct memfd_batch_header *header, uint32_t count,
+			 uint64_t size)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, MEMFD_MAGIC, sizeof(MEMFD_MAGIC));
+	header->version = MEMFD_VERSION;
+	header->count = count;
+	header->size = size;
+}
+
+/* the batch is sealed before it is sent - the consumer owns it afterwards */
+static int memfd_batch_send(void)
+{
+	struct memfd_batch_header header;
+	int ret = 0;
+
+	if (memfd_output.fd < 0)
+		return 0;
+
+	/* F_SEAL_WRITE fails while a writable mapping exists */
+	munmap(memfd_output.map, memfd_output.capacity);
+	memfd_output.map = NULL;
+
+	if (ftruncate(memfd_output.fd, (off_t)memfd_output.used) < 0 ||
+	    fcntl(memfd_output.fd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		ret = -errno;
+		fprintf(stderr, "Could not seal texture batch\n");
+	}
+
+	if (ret == 0) {
+		memfd_header(&header, memfd_output.count, memfd_output.used);
+		ret = memfd_send(&header, memfd_output.fd);
+	}
+
+	close(memfd_output.fd);
+	memfd_output.fd = -1;
+	memfd_output.count = 0;
+	memfd_output.used = 0;
+
+	return ret;
+}
+
+int memfd_output_add(const struct gliden64_file *file)
+{
+	struct memfd_batch_entry *entry;
+	uint64_t offset;
+	int ret;
+
+	offset = (memfd_output.used + MEMFD_ALIGNMENT - 1) & ~(uint64_t)(MEMFD_ALIGNMENT - 1);
+	if (memfd_output.fd >= 0 &&
+	    (memfd_output.count == MEMFD_BATCH_FILES ||
+	     offset + file->size > memfd_output.capacity)) {
+		ret = memfd_batch_send();
+		if (ret < 0)
+			return ret;
+
+		offset = 0;
+	}
+
+	if (memfd_output.fd < 0) {
+		ret = memfd_batch_open(file->size);
+		if (ret < 0) {
+			fprintf(stderr, "Could not create texture batch: %s\n", strerror(-ret));
+			return ret;
+		}
+	}
+
+	PROBE2(memfd__write, file->size, offset);
+	memcpy(memfd_output.map + offset, file->data, file->size);
+
+	entry = &memfd_output.entries[memfd_output.count++];
+	entry->checksum = file->checksum;
+	entry->offset = offset;
+	entry->size = file->size;
+	entry->width = file->width;
+	entry->height = file->height;
+	entry->source_format = file->source_format;
+
+	memfd_output.used = offset + file->size;
+
+	return 0;
+}
+
+int memfd_output_finish(void)
+{
+	struct memfd_batch_header header;
+	int ret;
+
+	ret = memfd_batch_send();
+	if (ret == 0) {
+		memfd_header(&header, 0, 0);
+		ret = memfd_send(&header, -1);
+	}
+
+	close(memfd_output.socket);
+	memfd_output.socket = -1;
+
+	return ret;
+}
+#else
+int memfd_output_init(void)
+{
+	fprintf(stderr, "memfd output is not supported on this platform\n");
+	return -EOPNOTSUPP;
+}
+
+int memfd_output_add(const struct gliden64_file *file)
+{
+	(void)file;
+
+	return -EOPNOTSUPP;
+}
+
+int memfd_output_finish(void)
+{
+	return -EOPNOTSUPP;
+}
+#endif
@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * The output directory contains a manifest (MANIFEST_NAME). Its first line
+ * stores a fingerprint of the options which change the written bytes:
+ *
+ *   # options <crc32 of the options>
+ *
+ * followed by one line per written texture:
+ *
+ *   <checksum> <crc32 of the cache payload> <file name>
+ *
+ * An incremental run compares the payload crc32 of each texture against the
+ * manifest and skips the conversion when it didn't change. All textures are
+ * written again when the options fingerprint differs.
+ */
+
+#include "gliden64_cache_extract.h"
+#include "probes.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define MANIFEST_NAME ".gliden64_manifest"
+
+struct manifest_entry {
+	uint64_t checksum;
+	size_t sequence;
+	uint32_t crc;
+	char name[100];
+};
+
+static struct {
+	struct manifest_entry *entries;
+	size_t count;
+	size_t capacity;
+	/* entries before this index are sorted by checksum */
+	size_t sorted;
+} manifest;
+
+static int manifest_compare(const void *a, const void *b)
+{
+	const struct manifest_entry *entry_a = a;
+	const struct manifest_entry *entry_b = b;
+
+	if (entry_a->checksum < entry_b->checksum)
+		return -1;
+	if (entry_a->checksum > entry_b->checksum)
+		return 1;
+
+	/* qsort isn't stable - later entries replace earlier ones */
+	if (entry_a->sequence != entry_b->sequence)
+		return entry_a->sequence < entry_b->sequence ? -1 : 1;
+
+	return 0;
+}
+
+static int manifest_compare_checksum(const void *a, const void *b)
+{
+	const struct manifest_entry *entry_a = a;
+	const struct manifest_entry *entry_b = b;
+
+	if (entry_a->checksum < entry_b->checksum)
+		return -1;
+	if (entry_a->checksum > entry_b->checksum)
+		return 1;
+
+	return 0;
+}
+
+static int manifest_append(uint64_t checksum, uint32_t crc, const char *name)
+{
+	struct manifest_entry *entries;
+	struct manifest_entry *entry;
+
+	if (manifest.count == manifest.capacity) {
+		manifest.capacity = manifest.capacity ? manifest.capacity * 2 : 1024;
+		entries = realloc(manifest.entries,
+				  manifest.capacity * sizeof(*entries));
+		if (!entries) {
+			fprintf(stderr, "Memory for manifest couldn't be allocated\n");
+			return -ENOMEM;
+		}
+		manifest.entries = entries;
+	}
+
+	entry = &manifest.entries[manifest.count++];
+	entry->checksum = checksum;
+	entry->sequence = manifest.count - 1;
+	entry->crc = crc;
+	snprintf(entry->name, sizeof(entry->name), "%s", name);
+
+	return 0;
+}
+
+/* only the entries of the loaded manifest are searched - textures added
+ * during this run are appended and deduplicated in output_dir_finish()
+ */
+static struct manifest_entry *manifest_find(uint64_t checksum)
+{
+	struct manifest_entry key;
+
+	if (!manifest.sorted)
+		return NULL;
+
+	key.checksum = checksum;
+
+	return bsearch(&key, manifest.entries, manifest.sorted,
+		       sizeof(*manifest.entries), manifest_compare_checksum);
+}
+
+/* sorts all entries and keeps only the last added entry of each checksum */
+static void manifest_sort(void)
+{
+	size_t i, count = 0;
+
+	qsort(manifest.entries, manifest.count, sizeof(*manifest.entries),
+	      manifest_compare);
+
+	for (i = 0; i < manifest.count; i++) {
+		if (i + 1 < manifest.count &&
+		    manifest.entries[i].checksum == manifest.entries[i + 1].checksum)
+			continue;
+
+		manifest.entries[count++] = manifest.entries[i];
+	}
+
+	manifest.count = count;
+	manifest.sorted = count;
+}
+
+/* options which change the written bytes but not the file names */
+static uint32_t output_dir_fingerprint(void)
+{
+	uint32_t options[] = {
+		(uint32_t)globals.image_format,
+		(uint32_t)globals.dds_compression,
+		(uint32_t)globals.bitmapv5,
+		(uint32_t)globals.native,
+		(uint32_t)globals.adaptive,
+		globals.thumbnail_width,
+		globals.thumbnail_height,
+	};
+
+	return (uint32_t)crc32(0, (const Bytef *)options, sizeof(options));
+}
+
+static void output_dir_path(char *path, size_t size, const char *name)
+{
+	snprintf(path, size, "%s/%s", globals.output_dir, name);
+}
+
+int output_dir_init(void)
+{
+	char path[4096];
+	char line[256];
+	uint64_t checksum;
+	uint32_t crc;
+	uint32_t fingerprint;
+	char *name;
+	FILE *f;
+	int offset;
+	int ret = 0;
+
+	output_dir_path(path, sizeof(path), MANIFEST_NAME);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+
+	/* the old files were written with other options - none is unchanged */
+	if (!fgets(line, sizeof(line), f) ||
+	    sscanf(line, "# options %"SCNx32, &fingerprint) != 1 ||
+	    fingerprint != output_dir_fingerprint()) {
+		if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+			fprintf(stderr, "Manifest was written with other options\n");
+		fclose(f);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		/* the name is the rest of the line - prefixes may contain spaces */
+		offset = 0;
+		if (sscanf(line, "%"SCNx64" %"SCNx32" %n", &checksum, &crc, &offset) != 2 ||
+		    offset == 0) {
+			fprintf(stderr, "Invalid manifest line in %s\n", path);
+			continue;
+		}
+
+		name = line + offset;
+		name[strcspn(name, "\r\n")] = '\0';
+
+		ret = manifest_append(checksum, crc, name);
+		if (ret < 0)
+			break;
+	}
+
+	fclose(f);
+
+	if (ret < 0)
+		return ret;
+
+	manifest_sort();
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Manifest lists %zu textures\n", manifest.count);
+
+	return 0;
+}
+
+/* unchanged textures must have the same payload, name and still exist */
+int output_dir_unchanged(const struct gliden64_file *file)
+{
+	struct manifest_entry *entry;
+	char path[4096];
+	char name[100];
+
+	entry = manifest_find(file->checksum);
+	if (!entry || entry->crc != file->payload_crc)
+		return 0;
+
+	file_name(file, name, sizeof(name));
+	if (strcmp(entry->name, name) != 0)
+		return 0;
+
+	output_dir_path(path, sizeof(path), name);
+	if (access(path, F_OK) != 0)
+		return 0;
+
+	return 1;
+}
+
+/* writes to a temporary file first - an interrupted run never leaves
+ * truncated files behind which the manifest would consider complete
+ */
+static int output_dir_write_file(const char *name, const void *data, size_t size)
+{
+	char path[4096];
+	char tmp_path[4096];
+	FILE *f;
+	int ret = 0;
+
+	output_dir_path(path, sizeof(path), name);
+	snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", globals.output_dir, name);
+
+	f = fopen(tmp_path, "wb");
+	if (!f) {
+		fprintf(stderr, "Could not open output file %s\n", tmp_path);
+		return -ENOENT;
+	}
+
+	if (fwrite(data, 1, size, f) != size)
+		ret = -EIO;
+
+	if (fclose(f) != 0)
+		ret = -EIO;
+
+	if (ret == 0 && rename(tmp_path, path) != 0)
+		ret = -EIO;
+
+	if (ret < 0) {
+		fprintf(stderr, "Could not write output file %s\n", path);
+		unlink(tmp_path);
+	}
+
+	return ret;
+}
+
+int output_dir_add(const struct gliden64_file *file)
+{
+	struct manifest_entry *entry;
+	char name[100];
+	int ret;
+
+	file_name(file, name, sizeof(name));
+	ret = output_dir_write_file(name, file->data, file->size);
+	PROBE2(dir__write, file->size, ret);
+	if (ret < 0)
+		return ret;
+
+	entry = manifest_find(file->checksum);
+	if (entry) {
+		entry->crc = file->payload_crc;
+		snprintf(entry->name, sizeof(entry->name), "%s", name);
+		return 0;
+	}
+
+	return manifest_append(file->checksum, file->payload_crc, name);
+}
+
+int output_dir_finish(void)
+{
+	struct manifest_entry *entry;
+	char *buffer, *pos;
+	size_t i;
+	int ret;
+
+	manifest_sort();
+
+	/* options line, checksum + crc + name + separators per line */
+	buffer = malloc(32 + manifest.count * (16 + 8 + sizeof(entry->name) + 3) + 1);
+	if (!buffer) {
+		fprintf(stderr, "Memory for manifest couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	pos = buffer;
+	pos += sprintf(pos, "# options %08"PRIX32"\n", output_dir_fingerprint());
+	for (i = 0; i < manifest.count; i++) {
+		entry = &manifest.entries[i];
+		pos += sprintf(pos, "%016"PRIX64" %08"PRIX32" %s\n",
+			       entry->checksum, entry->crc, entry->name);
+	}
+
+	ret = output_dir_write_file(MANIFEST_NAME, buffer, (size_t)(pos - buffer));
+	free(buffer);
+
+	return ret;
+}
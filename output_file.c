@@ -5,6 +5,7 @@
  */
 
 #include "gliden64_cache_extract.h"
+#include "probes.h"
 #include <errno.h>
 #include <inttypes.h>
 #include <stddef.h>
@@ -14,79 +15,137 @@
 
 uint8_t tarblock[512];
 
-int write_tarblock(void *buffer, size_t size, size_t offset)
+/* bytes written to the output so far - only used by the probes */
+static uint64_t output_offset;
+
+int output_write(const void *buffer, size_t size)
 {
-	size_t ret, padding_size;
+	size_t ret;
+
+	output_offset += size;
+
+	if (globals.output_backend)
+		return globals.output_backend->write(buffer, size);
 
 	ret = fwrite(buffer, 1, size, globals.out);
-	if (ret != size) {
-		fprintf(stderr, "Could not write file content\n");
+	if (ret != size)
 		return -EIO;
-	}
 
-	padding_size = (offset + size) % sizeof(tarblock);
-	if (padding_size) {
+	return 0;
+}
+
+int output_flush(void)
+{
+	if (globals.output_backend)
+		return globals.output_backend->flush();
+
+	if (fflush(globals.out) != 0)
+		return -EIO;
+
+	return 0;
+}
+
+/* zeros which fill the data up to the next tarblock */
+size_t tar_padding(size_t size)
+{
+	size_t padding_size;
+
+	padding_size = size % sizeof(tarblock);
+	if (padding_size)
 		padding_size = sizeof(tarblock) - padding_size;
 
-		ret = fwrite(tarblock, 1, padding_size, globals.out);
-		if (ret != padding_size) {
+	return padding_size;
+}
+
+int write_tarblock(void *buffer, size_t size)
+{
+	size_t padding_size;
+	int ret;
+
+	PROBE2(tar__write, size, output_offset);
+	ret = output_write(buffer, size);
+	if (ret < 0) {
+		fprintf(stderr, "Could not write file content\n");
+		return ret;
+	}
+
+	padding_size = tar_padding(size);
+	if (padding_size) {
+		ret = output_write(tarblock, padding_size);
+		if (ret < 0) {
 			fprintf(stderr, "Could not write padding\n");
-			return -EIO;
+			return ret;
 		}
 	}
 
 	return 0;
 }
 
-static const char *image_extension(void)
+const char *image_extension(void)
 {
-	return "bmp";
+	switch (globals.image_format) {
+	case IMAGE_DDS:
+		return "dds";
+	case IMAGE_BMP:
+	default:
+		return "bmp";
+	}
 }
 
-int write_file(struct gliden64_file *file)
+void file_name(const struct gliden64_file *file, char *name, size_t size)
+{
+	/* TODO fix this test by identifying ci mode with palette, set fmt+size in name */
+	if ((uint32_t)(file->checksum >> 32) != 0)
+		snprintf(name, size, "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"#%08"PRIX32"_ciByRGBA.%s", globals.prefix, (uint32_t)file->checksum, 3 , 0, (uint32_t)(file->checksum >> 32), image_extension());
+	else
+		snprintf(name, size, "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"_all.%s", globals.prefix, (uint32_t)file->checksum, 3 , 0, image_extension());
+}
+
+void tar_entry_header(struct tar_header *header, const char *name, uint32_t size)
 {
-	struct tar_header tarheader;
 	uint8_t *raw_header;
 	uint32_t checksum = 0;
 	size_t i;
-	int ret;
-
-	memset(&tarheader, 0, sizeof(tarheader));
 
-	/* TODO fix this test by identifying ci mode with palette, set fmt+size in name */
-	if ((uint32_t)(file->checksum >> 32) != 0)
-		snprintf(tarheader.name, sizeof(tarheader.name), "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"#%08"PRIX32"_ciByRGBA.%s", globals.prefix, (uint32_t)file->checksum, 3 , 0, (uint32_t)(file->checksum >> 32), image_extension());
-	else
-		snprintf(tarheader.name, sizeof(tarheader.name), "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"_all.%s", globals.prefix, (uint32_t)file->checksum, 3 , 0, image_extension());
+	memset(header, 0, sizeof(*header));
 
-	tarheader.name[sizeof(tarheader.name) - 1] = '\0';
+	snprintf(header->name, sizeof(header->name), "%s", name);
+	header->name[sizeof(header->name) - 1] = '\0';
 
-	strcpy(tarheader.mode, "0000644");
-	strcpy(tarheader.uid, "0000000");
-	strcpy(tarheader.gid, "0000000");
+	strcpy(header->mode, "0000644");
+	strcpy(header->uid, "0000000");
+	strcpy(header->gid, "0000000");
 
-	snprintf(tarheader.size, sizeof(tarheader.size), "%011"PRIo32, file->size);
-	tarheader.size[sizeof(tarheader.size) - 1] = '\0';
+	snprintf(header->size, sizeof(header->size), "%011"PRIo32, size);
+	header->size[sizeof(header->size) - 1] = '\0';
 
-	snprintf(tarheader.mtime, sizeof(tarheader.mtime), "%011o", 1);
-	tarheader.mtime[sizeof(tarheader.mtime) - 1] = '\0';
-	memset(tarheader.chksum, ' ', sizeof(tarheader.chksum));
-	tarheader.link = 0;
+	snprintf(header->mtime, sizeof(header->mtime), "%011o", 1);
+	header->mtime[sizeof(header->mtime) - 1] = '\0';
+	memset(header->chksum, ' ', sizeof(header->chksum));
+	header->link = 0;
 
-	raw_header = (void *)&tarheader;
-	for (i = 0; i < sizeof(tarheader); i++)
+	raw_header = (void *)header;
+	for (i = 0; i < sizeof(*header); i++)
 		checksum += raw_header[i];
 	checksum %= 0x40000U;
 
-	snprintf(tarheader.chksum, sizeof(tarheader.chksum) - 1, "%06"PRIo32, checksum);
+	snprintf(header->chksum, sizeof(header->chksum) - 1, "%06"PRIo32, checksum);
+}
+
+int write_tar_entry(const char *name, void *data, uint32_t size)
+{
+	struct tar_header tarheader;
+	int ret;
 
-	ret = write_tarblock(&tarheader, sizeof(tarheader), 0);
+	tar_entry_header(&tarheader, name, size);
+
+	ret = write_tarblock(&tarheader, sizeof(tarheader));
 	if (ret < 0) {
 		fprintf(stderr, "Failed to write tar header\n");
 		return ret;
 	}
 
-	ret = write_tarblock(file->data, file->size, 0);
+	ret = write_tarblock(data, size);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to write file content\n");
 		return ret;
@@ -94,3 +153,94 @@ int write_file(struct gliden64_file *file)
 
 	return 0;
 }
+
+int write_file(struct gliden64_file *file)
+{
+	char name[100];
+
+	switch (globals.output_format) {
+	case OUTPUT_BLOB:
+		return blob_store_add(file);
+	case OUTPUT_DIR:
+		return output_dir_add(file);
+	case OUTPUT_SHARDS:
+		return shards_add(file);
+	case OUTPUT_MEMFD:
+		return memfd_output_add(file);
+	case OUTPUT_TAR:
+	default:
+		if (globals.reorder_size)
+			return reorder_add(file);
+
+		file_name(file, name, sizeof(name));
+		return write_tar_entry(name, file->data, file->size);
+	}
+}
+
+static int finish_tar(void)
+{
+	int ret;
+
+	if (globals.reorder_size) {
+		ret = reorder_finish();
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = write_tarblock(tarblock, sizeof(tarblock));
+	if (ret < 0) {
+		fprintf(stderr, "Failed to write first EOF tar record\n");
+		return ret;
+	}
+
+	ret = write_tarblock(tarblock, sizeof(tarblock));
+	if (ret < 0) {
+		fprintf(stderr, "Failed to write second EOF tar record\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+int output_finish(void)
+{
+	int ret;
+
+	switch (globals.output_format) {
+	case OUTPUT_BLOB:
+		ret = blob_store_finish();
+		if (ret < 0)
+			fprintf(stderr, "Failed to write blob store index\n");
+		break;
+	case OUTPUT_DIR:
+		ret = output_dir_finish();
+		if (ret < 0)
+			fprintf(stderr, "Failed to write manifest\n");
+		break;
+	case OUTPUT_SHARDS:
+		ret = shards_finish();
+		if (ret < 0)
+			fprintf(stderr, "Failed to finish shards\n");
+		break;
+	case OUTPUT_MEMFD:
+		ret = memfd_output_finish();
+		if (ret < 0)
+			fprintf(stderr, "Failed to finish memfd output\n");
+		break;
+	case OUTPUT_TAR:
+	default:
+		ret = finish_tar();
+		break;
+	}
+
+	if (ret < 0)
+		return ret;
+
+	ret = output_flush();
+	if (ret < 0) {
+		fprintf(stderr, "Failed to flush output\n");
+		return ret;
+	}
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* number of bands per thread to even out differently fast workers */
+#define PARALLEL_BANDS_PER_THREAD 4
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	pthread_mutex_t busy;
+	unsigned int threads;
+	unsigned long generation;
+	parallel_fn fn;
+	void *ctx;
+	size_t count;
+	size_t band;
+	size_t next;
+	size_t finished;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.busy = PTHREAD_MUTEX_INITIALIZER,
+	.threads = 1,
+};
+
+/* must be called with pool.lock held, returns with pool.lock held */
+static void parallel_run_bands(void)
+{
+	size_t start, end;
+
+	while (pool.next < pool.count) {
+		start = pool.next;
+		end = start + pool.band;
+		if (end > pool.count)
+			end = pool.count;
+		pool.next = end;
+
+		pthread_mutex_unlock(&pool.lock);
+		pool.fn(start, end, pool.ctx);
+		pthread_mutex_lock(&pool.lock);
+
+		pool.finished += end - start;
+		if (pool.finished == pool.count)
+			pthread_cond_broadcast(&pool.done);
+	}
+}
+
+static void *parallel_worker(void *arg)
+{
+	unsigned long generation = 0;
+
+	(void)arg;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (pool.generation == generation)
+			pthread_cond_wait(&pool.start, &pool.lock);
+
+		generation = pool.generation;
+		parallel_run_bands();
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+unsigned int parallel_threads(void)
+{
+	return pool.threads;
+}
+
+int parallel_init(unsigned int threads)
+{
+	pthread_t thread;
+	unsigned int i;
+	long cpus;
+	int ret;
+
+	if (threads == 0) {
+		threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus > 0)
+			threads = (unsigned int)cpus;
+#else
+		(void)cpus;
+#endif
+	}
+
+	/* the calling thread always works on the bands too */
+	for (i = 1; i < threads; i++) {
+		ret = pthread_create(&thread, NULL, parallel_worker, NULL);
+		if (ret != 0) {
+			fprintf(stderr, "Could only start %u worker threads\n", i - 1);
+			break;
+		}
+
+		pthread_detach(thread);
+		pool.threads++;
+	}
+
+	return 0;
+}
+
+void parallel_for(size_t count, parallel_fn fn, void *ctx)
+{
+	size_t bands;
+
+	if (count == 0)
+		return;
+
+	/* nested or concurrent users run the work on their own thread */
+	if (pool.threads == 1 || pthread_mutex_trylock(&pool.busy) != 0) {
+		fn(0, count, ctx);
+		return;
+	}
+
+	bands = (size_t)pool.threads * PARALLEL_BANDS_PER_THREAD;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.fn = fn;
+	pool.ctx = ctx;
+	pool.count = count;
+	pool.band = (count + bands - 1) / bands;
+	pool.next = 0;
+	pool.finished = 0;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.start);
+
+	parallel_run_bands();
+	while (pool.finished != pool.count)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+
+	pthread_mutex_unlock(&pool.busy);
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#ifndef _GLIDEN64_CACHE_EXTRACT_PROBES_H_
+#define _GLIDEN64_CACHE_EXTRACT_PROBES_H_
+
+/**
+ * USDT probes of the provider gliden64_cache_extract. They are only built
+ * when sys/sdt.h was found and cost a single nop while no tracer is attached:
+ *
+ *   file__start(checksum, width, height, format, size)
+ *   file__done(checksum, format, output size, error)
+ *   decompress__start(checksum, format, compressed size)
+ *   decompress__done(checksum, decompressed size, zlib error)
+ *   normalize__start(checksum, format, width, height)
+ *   normalize__done(checksum, format, size, error)
+ *   tar__write(size, offset in the output)
+ *   blob__write(size, offset in the blob store)
+ *   shard__write(shard, size, offset in the shard)
+ *   dir__write(size, error)
+ *   memfd__write(size, offset in the batch)
+ *
+ * e.g. bpftrace -e 'usdt:./gliden64_cache_extract:file__start { ... }'
+ */
+
+#ifdef HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define PROBE2(name, a1, a2) \
+	DTRACE_PROBE2(gliden64_cache_extract, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) \
+	DTRACE_PROBE3(gliden64_cache_extract, name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(gliden64_cache_extract, name, a1, a2, a3, a4)
+#define PROBE5(name, a1, a2, a3, a4, a5) \
+	DTRACE_PROBE5(gliden64_cache_extract, name, a1, a2, a3, a4, a5)
+
+#else /* HAVE_SDT */
+
+#define PROBE2(name, a1, a2) do { } while (0)
+#define PROBE3(name, a1, a2, a3) do { } while (0)
+#define PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#define PROBE5(name, a1, a2, a3, a4, a5) do { } while (0)
+
+#endif /* HAVE_SDT */
+
+#endif /* _GLIDEN64_CACHE_EXTRACT_PROBES_H_ */
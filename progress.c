@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * The stages only increase relaxed atomic counters. A separate thread reads
+ * them - every second for --progress and on SIGUSR1 for a dump of all
+ * counters. SIGUSR1 is blocked in all other threads and collected by this
+ * thread with sigtimedwait(), so the signal never interrupts a syscall of the
+ * extraction.
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGRESS_INTERVAL 1
+
+static struct {
+	uint64_t input_offset;
+	uint64_t files_read;
+	uint64_t files_filtered;
+	uint64_t files_decompressed;
+	uint64_t compressed_bytes;
+	uint64_t decompressed_bytes;
+	uint64_t files_failed;
+	uint64_t files_written;
+	uint64_t bytes_written;
+} counters;
+
+#define counter_add(name, value) \
+	__atomic_fetch_add(&counters.name, (value), __ATOMIC_RELAXED)
+#define counter_get(name) \
+	__atomic_load_n(&counters.name, __ATOMIC_RELAXED)
+
+void progress_read(long offset)
+{
+	counter_add(files_read, 1);
+	if (offset >= 0)
+		__atomic_store_n(&counters.input_offset, (uint64_t)offset, __ATOMIC_RELAXED);
+}
+
+void progress_filtered(void)
+{
+	counter_add(files_filtered, 1);
+}
+
+void progress_decompressed(uint64_t compressed, uint64_t decompressed)
+{
+	counter_add(files_decompressed, 1);
+	counter_add(compressed_bytes, compressed);
+	counter_add(decompressed_bytes, decompressed);
+}
+
+void progress_failed(void)
+{
+	counter_add(files_failed, 1);
+}
+
+void progress_written(uint64_t size)
+{
+	counter_add(files_written, 1);
+	counter_add(bytes_written, size);
+}
+
+#ifndef __WIN32__
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static struct {
+	pthread_t thread;
+	int started;
+	int stop;
+	struct timespec start;
+} progress;
+
+static double progress_elapsed(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double)(now.tv_sec - progress.start.tv_sec) +
+	       (double)(now.tv_nsec - progress.start.tv_nsec) / 1e9;
+}
+
+/* size of the input file - unknown for pipes and offsets into decompressed
+ * data of gzip files
+ */
+static int progress_input_size(uint64_t *size)
+{
+	struct stat st;
+
+	if (globals.gzip_index)
+		return -EOPNOTSUPP;
+
+	if (fstat(fileno(globals.in), &st) < 0 || !S_ISREG(st.st_mode))
+		return -EOPNOTSUPP;
+
+	*size = (uint64_t)st.st_size;
+
+	return 0;
+}
+
+static void progress_line(void)
+{
+	uint64_t offset = counter_get(input_offset);
+	uint64_t files = counter_get(files_read);
+	double elapsed = progress_elapsed();
+	double files_rate = 0.0, bytes_rate = 0.0;
+	uint64_t remaining;
+	uint64_t size;
+
+	if (elapsed > 0.0) {
+		files_rate = (double)files / elapsed;
+		bytes_rate = (double)offset / elapsed;
+	}
+
+	if (progress_input_size(&size) < 0 || size == 0) {
+		fprintf(stderr, "Progress: %.1f MiB, %"PRIu64" files, %.0f files/s, %.1f MiB/s\n",
+			(double)offset / (1024 * 1024), files, files_rate,
+			bytes_rate / (1024 * 1024));
+		return;
+	}
+
+	remaining = size > offset ? size - offset : 0;
+	fprintf(stderr, "Progress: %.1f/%.1f MiB (%.1f%%), %"PRIu64" files, %.0f files/s, %.1f MiB/s",
+		(double)offset / (1024 * 1024), (double)size / (1024 * 1024),
+		100.0 * (double)offset / (double)size, files, files_rate,
+		bytes_rate / (1024 * 1024));
+
+	if (bytes_rate > 0.0) {
+		uint64_t eta = (uint64_t)((double)remaining / bytes_rate);
+
+		fprintf(stderr, ", ETA %"PRIu64":%02"PRIu64":%02"PRIu64"\n",
+			eta / 3600, eta / 60 % 60, eta % 60);
+	} else {
+		fprintf(stderr, "\n");
+	}
+}
+
+static void progress_dump(void)
+{
+	uint64_t fixed, dynamic;
+
+	budget_usage(&fixed, &dynamic);
+
+	fprintf(stderr, "Statistics after %.1f s:\n", progress_elapsed());
+	fprintf(stderr, "\tinput: %"PRIu64" bytes, %"PRIu64" files\n",
+		counter_get(input_offset), counter_get(files_read));
+	fprintf(stderr, "\tfiltered out: %"PRIu64" files\n", counter_get(files_filtered));
+	fprintf(stderr, "\tdecompressed: %"PRIu64" files, %"PRIu64" -> %"PRIu64" bytes\n",
+		counter_get(files_decompressed), counter_get(compressed_bytes),
+		counter_get(decompressed_bytes));
+	fprintf(stderr, "\tfailed: %"PRIu64" files\n", counter_get(files_failed));
+	fprintf(stderr, "\twritten: %"PRIu64" files, %"PRIu64" bytes\n",
+		counter_get(files_written), counter_get(bytes_written));
+	if (globals.max_memory)
+		fprintf(stderr, "\tmemory budget: %"PRIu64" bytes of buffers, %"PRIu64" bytes of files in flight\n",
+			fixed, dynamic);
+}
+
+static void *progress_thread(void *arg)
+{
+	struct timespec timeout;
+	sigset_t set;
+	int sig;
+
+	(void)arg;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+
+	while (1) {
+		timeout.tv_sec = PROGRESS_INTERVAL;
+		timeout.tv_nsec = 0;
+
+		/* without --progress only SIGUSR1 wakes up this thread */
+		if (globals.progress)
+			sig = sigtimedwait(&set, NULL, &timeout);
+		else
+			sig = sigwaitinfo(&set, NULL);
+
+		if (__atomic_load_n(&progress.stop, __ATOMIC_ACQUIRE))
+			break;
+
+		if (sig == SIGUSR1)
+			progress_dump();
+		else if (sig < 0 && errno == EAGAIN)
+			progress_line();
+	}
+
+	return NULL;
+}
+
+/* has to run before any other thread is started - they inherit the blocked
+ * SIGUSR1
+ */
+int progress_init(void)
+{
+	sigset_t set;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &progress.start);
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	ret = pthread_sigmask(SIG_BLOCK, &set, NULL);
+	if (ret != 0)
+		return -ret;
+
+	ret = pthread_create(&progress.thread, NULL, progress_thread, NULL);
+	if (ret != 0) {
+		pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+		return -ret;
+	}
+
+	progress.started = 1;
+
+	return 0;
+}
+
+void progress_finish(void)
+{
+	long pos = input_tell();
+
+	if (!progress.started)
+		return;
+
+	/* the last file header isn't the end of the input */
+	if (pos >= 0)
+		__atomic_store_n(&counters.input_offset, (uint64_t)pos, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&progress.stop, 1, __ATOMIC_RELEASE);
+	pthread_kill(progress.thread, SIGUSR1);
+	pthread_join(progress.thread, NULL);
+	progress.started = 0;
+
+	if (globals.progress)
+		progress_line();
+}
+#else
+int progress_init(void)
+{
+	if (globals.progress) {
+		fprintf(stderr, "--progress is not supported on this platform\n");
+		return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+void progress_finish(void)
+{
+}
+#endif
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * The reorder buffer collects encoded textures until their size reaches the
+ * limit. They are then written sorted by source format, dimensions and the
+ * mean value of their bytes - similar textures end up next to each other in
+ * the window of a compressor which is used on the tar file later.
+ *
+ * The buffer is only emptied when it is full or at the end of the input, so
+ * the order only depends on the input and the limit.
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct reorder_entry {
+	void *data;
+	uint32_t size;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t content;
+	uint64_t sequence;
+	char name[100];
+};
+
+static struct {
+	struct reorder_entry *entries;
+	size_t count;
+	size_t capacity;
+	uint64_t bytes;
+	uint64_t sequence;
+} reorder;
+
+int reorder_init(void)
+{
+	return budget_reserve_static(globals.reorder_size);
+}
+
+/* mean of all bytes in 1/256 steps - textures with similar colors and
+ * similar amounts of transparency get close values
+ */
+static uint32_t reorder_content(const uint8_t *data, uint32_t size)
+{
+	uint64_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < size; i++)
+		sum += data[i];
+
+	return (uint32_t)((sum << 8) / size);
+}
+
+static int reorder_compare(const void *a, const void *b)
+{
+	const struct reorder_entry *entry_a = a;
+	const struct reorder_entry *entry_b = b;
+
+	if (entry_a->format != entry_b->format)
+		return entry_a->format < entry_b->format ? -1 : 1;
+
+	if (entry_a->width != entry_b->width)
+		return entry_a->width < entry_b->width ? -1 : 1;
+
+	if (entry_a->height != entry_b->height)
+		return entry_a->height < entry_b->height ? -1 : 1;
+
+	if (entry_a->content != entry_b->content)
+		return entry_a->content < entry_b->content ? -1 : 1;
+
+	/* qsort isn't stable - equal keys keep the order of the input */
+	if (entry_a->sequence != entry_b->sequence)
+		return entry_a->sequence < entry_b->sequence ? -1 : 1;
+
+	return 0;
+}
+
+int reorder_flush(void)
+{
+	struct reorder_entry *entry;
+	size_t i;
+	int ret = 0;
+
+	qsort(reorder.entries, reorder.count, sizeof(*reorder.entries),
+	      reorder_compare);
+
+	for (i = 0; i < reorder.count; i++) {
+		entry = &reorder.entries[i];
+
+		if (ret == 0)
+			ret = write_tar_entry(entry->name, entry->data, entry->size);
+
+		free(entry->data);
+	}
+
+	reorder.count = 0;
+	reorder.bytes = 0;
+
+	return ret;
+}
+
+/* the buffered entry takes over the file content */
+int reorder_add(struct gliden64_file *file)
+{
+	struct reorder_entry *entries;
+	struct reorder_entry *entry;
+	int ret;
+
+	if (reorder.bytes + file->size > globals.reorder_size) {
+		ret = reorder_flush();
+		if (ret < 0)
+			return ret;
+	}
+
+	if (reorder.count == reorder.capacity) {
+		reorder.capacity = reorder.capacity ? reorder.capacity * 2 : 256;
+		entries = realloc(reorder.entries, reorder.capacity * sizeof(*entries));
+		if (!entries) {
+			fprintf(stderr, "Memory for reorder buffer couldn't be allocated\n");
+			return -ENOMEM;
+		}
+		reorder.entries = entries;
+	}
+
+	entry = &reorder.entries[reorder.count++];
+	entry->data = file->data;
+	entry->size = file->size;
+	entry->format = file->source_format;
+	entry->width = file->width;
+	entry->height = file->height;
+	entry->content = reorder_content(file->data, file->size);
+	entry->sequence = reorder.sequence++;
+	file_name(file, entry->name, sizeof(entry->name));
+	file->data = NULL;
+
+	reorder.bytes += file->size;
+
+	/* files larger than the limit are written on their own */
+	if (reorder.bytes > globals.reorder_size)
+		return reorder_flush();
+
+	return 0;
+}
+
+int reorder_finish(void)
+{
+	int ret;
+
+	ret = reorder_flush();
+	free(reorder.entries);
+	memset(&reorder, 0, sizeof(reorder));
+
+	return ret;
+}
@@ -0,0 +1,437 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * The report is gathered from the file headers alone and the payloads are
+ * skipped. The decompressed size of a file is implied by its dimensions and
+ * format, so compression ratios don't need an inflate pass either (--verify
+ * checks that the payloads actually match their headers).
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* histogram buckets by bit length: bucket b holds [2^(b-1), 2^b - 1] */
+#define REPORT_BUCKETS 33
+#define REPORT_TOP_COMBINATIONS 16
+
+struct report_bytes {
+	uint64_t files;
+	uint64_t stored;
+	uint64_t content;
+};
+
+struct report_format {
+	uint32_t format;
+	struct report_bytes bytes;
+	struct report_bytes compressed;
+};
+
+struct report_combination {
+	uint16_t texture_format;
+	uint16_t pixel_type;
+	uint64_t files;
+};
+
+static struct {
+	struct report_bytes total;
+	struct report_bytes compressed;
+	struct report_bytes hires;
+	struct report_bytes non_hires;
+	struct report_format *formats;
+	size_t formats_count;
+	struct report_combination *combinations;
+	size_t combinations_count;
+	uint64_t width[REPORT_BUCKETS];
+	uint64_t height[REPORT_BUCKETS];
+} report;
+
+static const char *report_format_name(uint32_t format)
+{
+	switch (format) {
+	case GR_RGBA8:
+		return "rgba8";
+	case GR_RGB:
+		return "rgb565";
+	case GR_RGBA4:
+		return "rgba4";
+	case GR_RGB5_A1:
+		return "rgb5_a1";
+	default:
+		return "unknown";
+	}
+}
+
+static uint64_t report_content_length(const struct gliden64_file *file)
+{
+	unsigned int bytes_per_pixel = texture_bytes_per_pixel(file->format);
+
+	/* unknown layout - count the stored bytes */
+	if (!bytes_per_pixel)
+		return file->size;
+
+	return (uint64_t)file->width * file->height * bytes_per_pixel;
+}
+
+static unsigned int report_bucket(uint32_t value)
+{
+	unsigned int bucket = 0;
+
+	while (value) {
+		bucket++;
+		value >>= 1;
+	}
+
+	return bucket;
+}
+
+static void report_bytes_add(struct report_bytes *bytes,
+			     const struct gliden64_file *file, uint64_t content)
+{
+	bytes->files++;
+	bytes->stored += file->size;
+	bytes->content += content;
+}
+
+static struct report_format *report_format_get(uint32_t format)
+{
+	struct report_format *formats;
+	size_t i;
+
+	for (i = 0; i < report.formats_count; i++) {
+		if (report.formats[i].format == format)
+			return &report.formats[i];
+	}
+
+	formats = realloc(report.formats, (report.formats_count + 1) * sizeof(*formats));
+	if (!formats)
+		return NULL;
+
+	report.formats = formats;
+	memset(&formats[i], 0, sizeof(formats[i]));
+	formats[i].format = format;
+	report.formats_count++;
+
+	return &formats[i];
+}
+
+static struct report_combination *report_combination_get(uint16_t texture_format,
+							 uint16_t pixel_type)
+{
+	struct report_combination *combinations;
+	size_t i;
+
+	for (i = 0; i < report.combinations_count; i++) {
+		if (report.combinations[i].texture_format == texture_format &&
+		    report.combinations[i].pixel_type == pixel_type)
+			return &report.combinations[i];
+	}
+
+	combinations = realloc(report.combinations,
+			       (report.combinations_count + 1) * sizeof(*combinations));
+	if (!combinations)
+		return NULL;
+
+	report.combinations = combinations;
+	combinations[i].texture_format = texture_format;
+	combinations[i].pixel_type = pixel_type;
+	combinations[i].files = 0;
+	report.combinations_count++;
+
+	return &combinations[i];
+}
+
+static int report_add(const struct gliden64_file *file)
+{
+	struct report_combination *combination;
+	struct report_format *format;
+	uint64_t content;
+
+	format = report_format_get(file->format & ~GR_TEXFMT_GZ);
+	combination = report_combination_get(file->texture_format, file->pixel_type);
+	if (!format || !combination) {
+		fprintf(stderr, "Memory for report couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	content = report_content_length(file);
+
+	report_bytes_add(&report.total, file, content);
+	report_bytes_add(&format->bytes, file, content);
+	if (file->format & GR_TEXFMT_GZ) {
+		report_bytes_add(&report.compressed, file, content);
+		report_bytes_add(&format->compressed, file, content);
+	}
+
+	if (file->is_hires_tex)
+		report_bytes_add(&report.hires, file, content);
+	else
+		report_bytes_add(&report.non_hires, file, content);
+
+	report.width[report_bucket(file->width)]++;
+	report.height[report_bucket(file->height)]++;
+	combination->files++;
+
+	return 0;
+}
+
+static int report_next(void)
+{
+	struct gliden64_file file;
+	uint64_t remaining;
+	long pos = input_tell();
+	int ret;
+
+	if (globals.recover && !recover_header_plausible(pos))
+		return recover_resync(pos);
+
+	ret = read_file_header(&file);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	if (file.size == 0) {
+		fprintf(stderr, "Invalid filesize\n");
+		return -EINVAL;
+	}
+
+	if (input_remaining(&remaining, file.size) == 0 && file.size > remaining) {
+		fprintf(stderr, "Filesize %"PRIu32" exceeds the remaining %"PRIu64" bytes of input\n",
+			file.size, remaining);
+		return -EINVAL;
+	}
+
+	if (filter_match(&file)) {
+		ret = report_add(&file);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = input_skip(file.size, 1);
+	if (ret < 0)
+		fprintf(stderr, "Failed to skip file content\n");
+
+	return ret;
+}
+
+static int report_printf(const char *fmt, ...)
+{
+	char line[512];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || (size_t)len >= sizeof(line))
+		return -EINVAL;
+
+	return output_write(line, (size_t)len);
+}
+
+static double report_ratio(const struct report_bytes *bytes)
+{
+	if (!bytes->stored)
+		return 0.0;
+
+	return (double)bytes->content / (double)bytes->stored;
+}
+
+static int report_write_bytes(const char *indent, const struct report_bytes *bytes)
+{
+	return report_printf("{\n"
+			     "%s\t\"files\": %"PRIu64",\n"
+			     "%s\t\"stored_bytes\": %"PRIu64",\n"
+			     "%s\t\"decompressed_bytes\": %"PRIu64",\n"
+			     "%s\t\"ratio\": %.3f\n"
+			     "%s}",
+			     indent, bytes->files, indent, bytes->stored,
+			     indent, bytes->content, indent, report_ratio(bytes),
+			     indent);
+}
+
+static int report_write_histogram(const char *name, const uint64_t *buckets)
+{
+	unsigned int i;
+	const char *separator = "";
+	uint64_t min, max;
+	int ret;
+
+	ret = report_printf("\t\"%s\": [", name);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < REPORT_BUCKETS; i++) {
+		if (!buckets[i])
+			continue;
+
+		min = i ? 1ULL << (i - 1) : 0;
+		max = i ? (1ULL << i) - 1 : 0;
+		ret = report_printf("%s\n\t\t{ \"min\": %"PRIu64", \"max\": %"PRIu64", \"files\": %"PRIu64" }",
+				    separator, min, max, buckets[i]);
+		if (ret < 0)
+			return ret;
+
+		separator = ",";
+	}
+
+	return report_printf("\n\t],\n");
+}
+
+static int report_compare_format(const void *a, const void *b)
+{
+	const struct report_format *format_a = a;
+	const struct report_format *format_b = b;
+
+	if (format_a->bytes.stored > format_b->bytes.stored)
+		return -1;
+	if (format_a->bytes.stored < format_b->bytes.stored)
+		return 1;
+
+	return 0;
+}
+
+static int report_compare_combination(const void *a, const void *b)
+{
+	const struct report_combination *combination_a = a;
+	const struct report_combination *combination_b = b;
+
+	if (combination_a->files > combination_b->files)
+		return -1;
+	if (combination_a->files < combination_b->files)
+		return 1;
+
+	return 0;
+}
+
+static int report_write(uint32_t config)
+{
+	struct report_combination *combination;
+	struct report_format *format;
+	size_t i;
+	int ret;
+
+	qsort(report.formats, report.formats_count, sizeof(*report.formats),
+	      report_compare_format);
+	qsort(report.combinations, report.combinations_count,
+	      sizeof(*report.combinations), report_compare_combination);
+
+	ret = report_printf("{\n\t\"config\": \"0x%08"PRIx32"\",\n\t\"total\": ", config);
+	if (ret < 0)
+		return ret;
+
+	ret = report_write_bytes("\t", &report.total);
+	if (ret < 0)
+		return ret;
+
+	ret = report_printf(",\n\t\"compressed\": ");
+	if (ret < 0)
+		return ret;
+
+	ret = report_write_bytes("\t", &report.compressed);
+	if (ret < 0)
+		return ret;
+
+	ret = report_printf(",\n\t\"hires\": ");
+	if (ret < 0)
+		return ret;
+
+	ret = report_write_bytes("\t", &report.hires);
+	if (ret < 0)
+		return ret;
+
+	ret = report_printf(",\n\t\"non_hires\": ");
+	if (ret < 0)
+		return ret;
+
+	ret = report_write_bytes("\t", &report.non_hires);
+	if (ret < 0)
+		return ret;
+
+	ret = report_printf(",\n\t\"formats\": [");
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < report.formats_count; i++) {
+		format = &report.formats[i];
+		ret = report_printf("%s\n\t\t{\n"
+				    "\t\t\t\"format\": \"%s\",\n"
+				    "\t\t\t\"value\": \"0x%08"PRIx32"\",\n"
+				    "\t\t\t\"files\": %"PRIu64",\n"
+				    "\t\t\t\"stored_bytes\": %"PRIu64",\n"
+				    "\t\t\t\"decompressed_bytes\": %"PRIu64",\n"
+				    "\t\t\t\"compressed_files\": %"PRIu64",\n"
+				    "\t\t\t\"compressed_ratio\": %.3f\n"
+				    "\t\t}",
+				    i ? "," : "", report_format_name(format->format),
+				    format->format, format->bytes.files,
+				    format->bytes.stored, format->bytes.content,
+				    format->compressed.files,
+				    report_ratio(&format->compressed));
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = report_printf("\n\t],\n");
+	if (ret < 0)
+		return ret;
+
+	ret = report_write_histogram("width_histogram", report.width);
+	if (ret < 0)
+		return ret;
+
+	ret = report_write_histogram("height_histogram", report.height);
+	if (ret < 0)
+		return ret;
+
+	ret = report_printf("\t\"texture_format_pixel_type_combinations\": %zu,\n"
+			    "\t\"top_texture_format_pixel_types\": [",
+			    report.combinations_count);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < report.combinations_count && i < REPORT_TOP_COMBINATIONS; i++) {
+		combination = &report.combinations[i];
+		ret = report_printf("%s\n\t\t{ \"texture_format\": \"0x%04"PRIx16"\", \"pixel_type\": \"0x%04"PRIx16"\", \"files\": %"PRIu64" }",
+				    i ? "," : "", combination->texture_format,
+				    combination->pixel_type, combination->files);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = report_printf("\n\t]\n}\n");
+	if (ret < 0)
+		return ret;
+
+	return output_flush();
+}
+
+int report_input(uint32_t config)
+{
+	int ret;
+
+	while (!input_eof()) {
+		ret = report_next();
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = report_write(config);
+	if (ret < 0)
+		fprintf(stderr, "Failed to write report\n");
+
+	free(report.formats);
+	free(report.combinations);
+
+	return ret;
+}
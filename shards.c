@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * Sharded output writes the textures into the tar files <output>.0 to
+ * <output>.N-1. Each shard has its own writer thread which is fed through a
+ * short queue. The writer takes all queued files at once and writes them
+ * without holding the lock. Queued files keep their memory budget until
+ * they are written. The output file itself gets a manifest with one line per
+ * texture:
+ *
+ *   <checksum> <shard> <file name>
+ */
+
+#include "gliden64_cache_extract.h"
+#include "probes.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* encoded files waiting per shard - bounds the memory not yet written */
+#define SHARD_QUEUE_LENGTH 16
+
+struct shard_entry {
+	void *data;
+	uint64_t reserved;
+	uint32_t size;
+	char name[100];
+};
+
+struct shard {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	FILE *out;
+	struct shard_entry queue[SHARD_QUEUE_LENGTH];
+	unsigned int queued;
+	unsigned int written;
+	int done;
+	int error;
+	uint64_t bytes;
+	/* bytes written by the writer thread so far - only used by the probes */
+	uint64_t offset;
+};
+
+struct shard_manifest_entry {
+	uint64_t checksum;
+	unsigned int shard;
+};
+
+static struct {
+	struct shard *shards;
+	unsigned int count;
+	struct shard_manifest_entry *manifest;
+	size_t manifest_count;
+	size_t manifest_capacity;
+} sharding;
+
+static int shard_write(FILE *out, const void *data, size_t size)
+{
+	size_t padding_size;
+
+	if (fwrite(data, 1, size, out) != size)
+		return -EIO;
+
+	padding_size = tar_padding(size);
+	if (padding_size && fwrite(tarblock, 1, padding_size, out) != padding_size)
+		return -EIO;
+
+	return 0;
+}
+
+static int shard_write_entry(struct shard *shard, const struct shard_entry *entry)
+{
+	struct tar_header tarheader;
+	int ret;
+
+	PROBE3(shard__write, (unsigned int)(shard - sharding.shards), entry->size,
+	       shard->offset);
+	shard->offset += sizeof(tarheader) + entry->size + tar_padding(entry->size);
+
+	tar_entry_header(&tarheader, entry->name, entry->size);
+
+	ret = shard_write(shard->out, &tarheader, sizeof(tarheader));
+	if (ret < 0)
+		return ret;
+
+	return shard_write(shard->out, entry->data, entry->size);
+}
+
+static void *shard_thread(void *arg)
+{
+	struct shard *shard = arg;
+	struct shard_entry *entry;
+	unsigned int first, last, i;
+	int error = 0;
+
+	pthread_mutex_lock(&shard->lock);
+	while (1) {
+		while (shard->queued == shard->written && !shard->done)
+			pthread_cond_wait(&shard->cond, &shard->lock);
+
+		if (shard->queued == shard->written)
+			break;
+
+		/* the entries are owned by this thread until written is increased */
+		first = shard->written;
+		last = shard->queued;
+		pthread_mutex_unlock(&shard->lock);
+
+		for (i = first; i != last; i++) {
+			entry = &shard->queue[i % SHARD_QUEUE_LENGTH];
+
+			if (!error && shard_write_entry(shard, entry) < 0)
+				error = 1;
+
+			free(entry->data);
+			entry->data = NULL;
+			budget_release(entry->reserved);
+		}
+
+		pthread_mutex_lock(&shard->lock);
+		/* only a full queue can have a producer waiting for a slot */
+		if (shard->queued - shard->written == SHARD_QUEUE_LENGTH || error)
+			pthread_cond_broadcast(&shard->cond);
+		shard->written = last;
+		shard->error = error;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	/* two empty tarblocks end each archive */
+	if (!error && (shard_write(shard->out, tarblock, sizeof(tarblock)) < 0 ||
+		       shard_write(shard->out, tarblock, sizeof(tarblock)) < 0))
+		error = 1;
+
+	if (fclose(shard->out) != 0)
+		error = 1;
+
+	pthread_mutex_lock(&shard->lock);
+	shard->error = error;
+	pthread_mutex_unlock(&shard->lock);
+
+	return NULL;
+}
+
+int shards_init(const char *path, unsigned int count)
+{
+	struct shard *shard;
+	char shard_path[4096];
+	unsigned int i;
+	int ret;
+
+	sharding.shards = calloc(count, sizeof(*sharding.shards));
+	if (!sharding.shards) {
+		fprintf(stderr, "Memory for shards couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < count; i++) {
+		shard = &sharding.shards[i];
+
+		snprintf(shard_path, sizeof(shard_path), "%s.%u", path, i);
+		shard->out = fopen(shard_path, "wb");
+		if (!shard->out) {
+			fprintf(stderr, "Could not open shard file %s\n", shard_path);
+			ret = -ENOENT;
+			goto err;
+		}
+
+		pthread_mutex_init(&shard->lock, NULL);
+		pthread_cond_init(&shard->cond, NULL);
+
+		ret = pthread_create(&shard->thread, NULL, shard_thread, shard);
+		if (ret != 0) {
+			fclose(shard->out);
+			fprintf(stderr, "Could not start writer thread for shard %u\n", i);
+			ret = -ret;
+			goto err;
+		}
+
+		sharding.count++;
+	}
+
+	return 0;
+
+err:
+	shards_finish();
+
+	return ret;
+}
+
+static unsigned int shard_select(const struct gliden64_file *file)
+{
+	unsigned int best = 0;
+	unsigned int i;
+
+	if (globals.shard_by_size) {
+		/* the shard with the fewest bytes so far gets the next texture */
+		for (i = 1; i < sharding.count; i++) {
+			if (sharding.shards[i].bytes < sharding.shards[best].bytes)
+				best = i;
+		}
+
+		return best;
+	}
+
+	/* the lower checksum bits are often zero for textures without palette */
+	return (unsigned int)(((file->checksum * 0x9e3779b97f4a7c15ULL) >> 32) %
+			      sharding.count);
+}
+
+static int shard_manifest_append(uint64_t checksum, unsigned int index)
+{
+	struct shard_manifest_entry *manifest;
+
+	if (sharding.manifest_count == sharding.manifest_capacity) {
+		sharding.manifest_capacity = sharding.manifest_capacity ?
+					     sharding.manifest_capacity * 2 : 1024;
+		manifest = realloc(sharding.manifest,
+				   sharding.manifest_capacity * sizeof(*manifest));
+		if (!manifest) {
+			fprintf(stderr, "Memory for shard manifest couldn't be allocated\n");
+			return -ENOMEM;
+		}
+		sharding.manifest = manifest;
+	}
+
+	sharding.manifest[sharding.manifest_count].checksum = checksum;
+	sharding.manifest[sharding.manifest_count].shard = index;
+	sharding.manifest_count++;
+
+	return 0;
+}
+
+/* the queued entry takes over the file content and its memory budget */
+int shards_add(struct gliden64_file *file)
+{
+	struct shard_entry *entry;
+	struct shard *shard;
+	unsigned int index;
+	int ret;
+
+	index = shard_select(file);
+	shard = &sharding.shards[index];
+
+	ret = shard_manifest_append(file->checksum, index);
+	if (ret < 0)
+		return ret;
+
+	pthread_mutex_lock(&shard->lock);
+	while (shard->queued - shard->written == SHARD_QUEUE_LENGTH && !shard->error)
+		pthread_cond_wait(&shard->cond, &shard->lock);
+
+	if (shard->error) {
+		pthread_mutex_unlock(&shard->lock);
+		fprintf(stderr, "Could not write to shard %u\n", index);
+		return -EIO;
+	}
+
+	entry = &shard->queue[shard->queued % SHARD_QUEUE_LENGTH];
+	entry->data = file->data;
+	entry->reserved = file->reserved;
+	entry->size = file->size;
+	file_name(file, entry->name, sizeof(entry->name));
+	file->data = NULL;
+	file->reserved = 0;
+
+	shard->bytes += sizeof(tarblock) + file->size + tar_padding(file->size);
+
+	/* the writer only sleeps on an empty queue */
+	if (shard->queued == shard->written)
+		pthread_cond_broadcast(&shard->cond);
+	shard->queued++;
+	pthread_mutex_unlock(&shard->lock);
+
+	return 0;
+}
+
+static int shards_write_manifest(void)
+{
+	struct shard_manifest_entry *entry;
+	struct gliden64_file file;
+	char name[100];
+	char line[160];
+	size_t i;
+	int len;
+	int ret;
+
+	memset(&file, 0, sizeof(file));
+	for (i = 0; i < sharding.manifest_count; i++) {
+		entry = &sharding.manifest[i];
+		file.checksum = entry->checksum;
+		file_name(&file, name, sizeof(name));
+
+		len = snprintf(line, sizeof(line), "%016"PRIX64" %u %s\n",
+			       entry->checksum, entry->shard, name);
+		ret = output_write(line, (size_t)len);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int shards_finish(void)
+{
+	struct shard *shard;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < sharding.count; i++) {
+		shard = &sharding.shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		shard->done = 1;
+		pthread_cond_broadcast(&shard->cond);
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	for (i = 0; i < sharding.count; i++) {
+		shard = &sharding.shards[i];
+
+		pthread_join(shard->thread, NULL);
+		if (shard->error) {
+			fprintf(stderr, "Could not write to shard %u\n", i);
+			ret = -EIO;
+		}
+
+		pthread_mutex_destroy(&shard->lock);
+		pthread_cond_destroy(&shard->cond);
+	}
+
+	if (ret == 0 && sharding.manifest_count)
+		ret = shards_write_manifest();
+
+	free(sharding.shards);
+	free(sharding.manifest);
+	memset(&sharding, 0, sizeof(sharding));
+
+	return ret;
+}
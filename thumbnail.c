@@ -0,0 +1,310 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+	uint8_t *data;
+	int reserved;
+	unsigned int index;
+	unsigned int cells;
+	char *manifest;
+	size_t manifest_len;
+} atlas;
+
+int parse_dimensions(const char *str, uint32_t *width, uint32_t *height)
+{
+	unsigned long w, h;
+	char *end;
+
+	w = strtoul(str, &end, 10);
+	if (*end != 'x' && *end != 'X')
+		return -EINVAL;
+
+	h = strtoul(end + 1, &end, 10);
+	if (*end != '\0' || w == 0 || h == 0 || w > 65536 || h > 65536)
+		return -EINVAL;
+
+	*width = (uint32_t)w;
+	*height = (uint32_t)h;
+
+	return 0;
+}
+
+/* area filter on premultiplied alpha - transparent pixels don't bleed
+ * their (usually black) color into the visible neighbors
+ */
+static void thumbnail_area_filter(const uint8_t *src, uint32_t width,
+				  uint32_t height, uint8_t *dst,
+				  uint32_t dst_width, uint32_t dst_height,
+				  uint64_t *acc)
+{
+	const uint8_t *pixel;
+	uint32_t dx, dy, x, y;
+	uint32_t x0, x1, y0, y1;
+	uint64_t count, a;
+	uint64_t *sum;
+	uint8_t *out;
+
+	for (dy = 0; dy < dst_height; dy++) {
+		y0 = (uint32_t)((uint64_t)dy * height / dst_height);
+		y1 = (uint32_t)((uint64_t)(dy + 1) * height / dst_height);
+
+		memset(acc, 0, dst_width * 4 * sizeof(*acc));
+		for (y = y0; y < y1; y++) {
+			for (dx = 0; dx < dst_width; dx++) {
+				x0 = (uint32_t)((uint64_t)dx * width / dst_width);
+				x1 = (uint32_t)((uint64_t)(dx + 1) * width / dst_width);
+				sum = &acc[dx * 4];
+				pixel = &src[((size_t)y * width + x0) * 4];
+
+				for (x = x0; x < x1; x++, pixel += 4) {
+					a = pixel[3];
+					sum[0] += pixel[0] * a;
+					sum[1] += pixel[1] * a;
+					sum[2] += pixel[2] * a;
+					sum[3] += a;
+				}
+			}
+		}
+
+		for (dx = 0; dx < dst_width; dx++) {
+			x0 = (uint32_t)((uint64_t)dx * width / dst_width);
+			x1 = (uint32_t)((uint64_t)(dx + 1) * width / dst_width);
+			count = (uint64_t)(x1 - x0) * (y1 - y0);
+			sum = &acc[dx * 4];
+			out = &dst[((size_t)dy * dst_width + dx) * 4];
+
+			if (sum[3]) {
+				out[0] = (uint8_t)((sum[0] + sum[3] / 2) / sum[3]);
+				out[1] = (uint8_t)((sum[1] + sum[3] / 2) / sum[3]);
+				out[2] = (uint8_t)((sum[2] + sum[3] / 2) / sum[3]);
+			} else {
+				out[0] = 0;
+				out[1] = 0;
+				out[2] = 0;
+			}
+			out[3] = (uint8_t)((sum[3] + count / 2) / count);
+		}
+	}
+}
+
+int thumbnail_resize(struct gliden64_file *file)
+{
+	uint32_t dst_width, dst_height;
+	uint64_t *acc;
+	uint8_t *buf;
+	size_t newsize;
+
+	if (file->format != GR_BGRA) {
+		fprintf(stderr, "Unsupported texture format %#x for thumbnails\n", file->format);
+		return -EPERM;
+	}
+
+	if (file->width <= globals.thumbnail_width &&
+	    file->height <= globals.thumbnail_height)
+		return 0;
+
+	/* keep the aspect ratio and never scale up */
+	if ((uint64_t)file->width * globals.thumbnail_height >
+	    (uint64_t)file->height * globals.thumbnail_width) {
+		dst_width = globals.thumbnail_width;
+		dst_height = (uint32_t)((uint64_t)file->height * dst_width / file->width);
+	} else {
+		dst_height = globals.thumbnail_height;
+		dst_width = (uint32_t)((uint64_t)file->width * dst_height / file->height);
+	}
+
+	if (dst_width == 0)
+		dst_width = 1;
+	if (dst_height == 0)
+		dst_height = 1;
+
+	newsize = (size_t)dst_width * dst_height * 4;
+	buf = malloc(newsize);
+	acc = malloc(dst_width * 4 * sizeof(*acc));
+	if (!buf || !acc) {
+		free(acc);
+		free(buf);
+		fprintf(stderr, "Memory for thumbnail couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	thumbnail_area_filter(file->data, file->width, file->height, buf,
+			      dst_width, dst_height, acc);
+	free(acc);
+
+	free(file->data);
+	file->data = buf;
+	file->width = dst_width;
+	file->height = dst_height;
+	file->size = (uint32_t)newsize;
+
+	return 0;
+}
+
+static size_t atlas_line_size(void)
+{
+	return (size_t)globals.atlas_columns * globals.thumbnail_width * 4;
+}
+
+static size_t atlas_size(void)
+{
+	return atlas_line_size() * globals.atlas_rows * globals.thumbnail_height;
+}
+
+static int atlas_manifest_add(const struct gliden64_file *file,
+			      unsigned int column, unsigned int row)
+{
+	char line[128];
+	char *manifest;
+	int len;
+
+	len = snprintf(line, sizeof(line), "%016"PRIX64" %u %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32"\n",
+		       file->checksum, atlas.index,
+		       column * globals.thumbnail_width,
+		       row * globals.thumbnail_height,
+		       file->width, file->height);
+	if (len < 0)
+		return -EINVAL;
+
+	manifest = realloc(atlas.manifest, atlas.manifest_len + (size_t)len + 1);
+	if (!manifest)
+		return -ENOMEM;
+
+	memcpy(manifest + atlas.manifest_len, line, (size_t)len + 1);
+	atlas.manifest = manifest;
+	atlas.manifest_len += (size_t)len;
+
+	return 0;
+}
+
+static void atlas_name(char *name, size_t size, const char *suffix)
+{
+	if (globals.prefix)
+		snprintf(name, size, "%s_atlas%s", globals.prefix, suffix);
+	else
+		snprintf(name, size, "atlas%s", suffix);
+}
+
+static int atlas_write(void)
+{
+	struct gliden64_file file;
+	unsigned int used_rows;
+	char suffix[32];
+	char name[100];
+	int ret;
+
+	if (atlas.cells == 0)
+		return 0;
+
+	/* the last atlas only gets the rows which are actually used */
+	used_rows = (atlas.cells + globals.atlas_columns - 1) / globals.atlas_columns;
+
+	memset(&file, 0, sizeof(file));
+	file.data = atlas.data;
+	file.width = globals.atlas_columns * globals.thumbnail_width;
+	file.height = used_rows * globals.thumbnail_height;
+	file.format = GR_BGRA;
+	file.size = (uint32_t)(atlas_line_size() * file.height);
+
+	atlas.data = NULL;
+	atlas.cells = 0;
+
+	ret = encode_image(&file);
+	if (ret < 0) {
+		free(file.data);
+		fprintf(stderr, "Failed to encode atlas\n");
+		return ret;
+	}
+
+	snprintf(suffix, sizeof(suffix), "_%04u.%s", atlas.index, image_extension());
+	atlas_name(name, sizeof(name), suffix);
+	ret = write_tar_entry(name, file.data, file.size);
+	free(file.data);
+	atlas.index++;
+
+	return ret;
+}
+
+int atlas_add(struct gliden64_file *file)
+{
+	unsigned int column, row;
+	size_t line_size;
+	uint8_t *target;
+	uint32_t y;
+	int ret;
+
+	if (file->format != GR_BGRA) {
+		fprintf(stderr, "Unsupported texture format %#x for atlas\n", file->format);
+		return -EPERM;
+	}
+
+	/* the atlas buffer is allocated again for each sheet */
+	if (!atlas.reserved) {
+		ret = budget_reserve_static(atlas_size());
+		if (ret < 0)
+			return ret;
+		atlas.reserved = 1;
+	}
+
+	if (!atlas.data) {
+		atlas.data = calloc(1, atlas_size());
+		if (!atlas.data) {
+			fprintf(stderr, "Memory for atlas couldn't be allocated\n");
+			return -ENOMEM;
+		}
+	}
+
+	column = atlas.cells % globals.atlas_columns;
+	row = atlas.cells / globals.atlas_columns;
+
+	ret = atlas_manifest_add(file, column, row);
+	if (ret < 0)
+		return ret;
+
+	line_size = atlas_line_size();
+	target = atlas.data + row * globals.thumbnail_height * line_size;
+	target += column * globals.thumbnail_width * 4;
+	for (y = 0; y < file->height; y++)
+		memcpy(target + y * line_size,
+		       (uint8_t *)file->data + (size_t)y * file->width * 4,
+		       (size_t)file->width * 4);
+
+	atlas.cells++;
+	if (atlas.cells == globals.atlas_columns * globals.atlas_rows)
+		return atlas_write();
+
+	return 0;
+}
+
+int atlas_finish(void)
+{
+	char name[100];
+	int ret;
+
+	ret = atlas_write();
+	if (ret < 0)
+		return ret;
+
+	if (!atlas.manifest)
+		return 0;
+
+	atlas_name(name, sizeof(name), ".txt");
+	ret = write_tar_entry(name, atlas.manifest, (uint32_t)atlas.manifest_len);
+	free(atlas.manifest);
+	atlas.manifest = NULL;
+	atlas.manifest_len = 0;
+
+	return ret;
+}
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* gliden64_cache_extract, GLideN64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+/**
+ * The verify mode reads the payloads of many files into one batch buffer and
+ * checks them on all threads of the pool. Nothing is converted or written -
+ * only the errors are reported in the order of the files in the cache.
+ */
+
+#include "gliden64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VERIFY_BATCH_SIZE (32 * 1024 * 1024)
+#define VERIFY_BATCH_FILES 8192
+
+struct verify_record {
+	struct gliden64_file file;
+	uint64_t index;
+	long offset;
+	const char *error;
+};
+
+static struct {
+	struct verify_record *records;
+	size_t count;
+	uint8_t *buffer;
+	size_t buffer_size;
+	size_t used;
+	uint64_t files;
+	uint64_t errors;
+} verify;
+
+static void verify_report(uint64_t index, long offset, uint64_t checksum,
+			  const char *error)
+{
+	verify.errors++;
+
+	if (offset >= 0)
+		fprintf(stderr, "File %"PRIu64" at %#lx (checksum %016"PRIX64"): %s\n",
+			index, offset, checksum, error);
+	else
+		fprintf(stderr, "File %"PRIu64" (checksum %016"PRIX64"): %s\n",
+			index, checksum, error);
+}
+
+static void verify_range(size_t start, size_t end, void *ctx)
+{
+	struct verify_record *records = ctx;
+	size_t i;
+
+	for (i = start; i < end; i++)
+		verify_file(&records[i].file, &records[i].error);
+}
+
+static void verify_flush(void)
+{
+	struct verify_record *record;
+	size_t i;
+
+	parallel_for(verify.count, verify_range, verify.records);
+
+	for (i = 0; i < verify.count; i++) {
+		record = &verify.records[i];
+		if (record->error)
+			verify_report(record->index, record->offset,
+				      record->file.checksum, record->error);
+	}
+
+	verify.count = 0;
+	verify.used = 0;
+}
+
+/* errors found while reading are reported after the files before them */
+static void verify_fail(uint64_t index, long offset, uint64_t checksum,
+			const char *error)
+{
+	verify_flush();
+	verify_report(index, offset, checksum, error);
+}
+
+/* files which don't fit into the batch buffer are checked on their own */
+static int verify_large(struct verify_record *record)
+{
+	int ret;
+
+	ret = budget_reserve(record->file.size);
+	if (ret < 0) {
+		verify_report(record->index, record->offset, record->file.checksum,
+			      "size exceeds the memory budget");
+		return input_skip(record->file.size, 1);
+	}
+
+	record->file.data = malloc(record->file.size);
+	if (!record->file.data) {
+		budget_release(record->file.size);
+		fprintf(stderr, "Could not allocate memory for file content\n");
+		return -ENOMEM;
+	}
+
+	ret = get_buffer(record->file.data, record->file.size, 0);
+	if (ret == 0) {
+		verify_file(&record->file, &record->error);
+		if (record->error)
+			verify_report(record->index, record->offset,
+				      record->file.checksum, record->error);
+	} else {
+		verify_report(record->index, record->offset, record->file.checksum,
+			      "file content truncated");
+		ret = 1;
+	}
+
+	free(record->file.data);
+	budget_release(record->file.size);
+
+	return ret;
+}
+
+/* returns 1 when the end of the cache was reached */
+static int verify_next(void)
+{
+	struct verify_record *record;
+	struct gliden64_file file;
+	uint64_t remaining;
+	uint64_t index;
+	long pos = input_tell();
+	long end;
+	int ret;
+
+	ret = read_file_header(&file);
+	if (ret < 0) {
+		verify_fail(verify.files, pos, 0, "file header truncated");
+		return 1;
+	}
+
+	if (ret > 0) {
+		/* fewer bytes than a checksum left behind the last file */
+		end = input_tell();
+		if (pos >= 0 && end > pos)
+			verify_fail(verify.files, pos, 0, "trailing data after the last file");
+		return 1;
+	}
+
+	index = verify.files++;
+	if (file.size == 0) {
+		verify_fail(index, pos, file.checksum, "invalid file size");
+		return 1;
+	}
+
+	if (input_remaining(&remaining, file.size) == 0 && file.size > remaining) {
+		verify_fail(index, pos, file.checksum, "file content truncated");
+		return 1;
+	}
+
+	if (!filter_match(&file))
+		return input_skip(file.size, 1);
+
+	if (verify.count == VERIFY_BATCH_FILES ||
+	    file.size > verify.buffer_size - verify.used)
+		verify_flush();
+
+	record = &verify.records[verify.count];
+	record->file = file;
+	record->index = index;
+	record->offset = pos;
+	record->error = NULL;
+
+	if (file.size > verify.buffer_size)
+		return verify_large(record);
+
+	record->file.data = verify.buffer + verify.used;
+	ret = get_buffer(record->file.data, file.size, 0);
+	if (ret < 0) {
+		verify_fail(index, pos, file.checksum, "file content truncated");
+		return 1;
+	}
+
+	verify.used += file.size;
+	verify.count++;
+
+	return 0;
+}
+
+int verify_input(void)
+{
+	int ret;
+
+	verify.buffer_size = VERIFY_BATCH_SIZE;
+	if (globals.max_memory && verify.buffer_size > globals.max_memory / 4)
+		verify.buffer_size = (size_t)(globals.max_memory / 4);
+
+	ret = budget_reserve_static(verify.buffer_size);
+	if (ret < 0)
+		return ret;
+
+	verify.buffer = malloc(verify.buffer_size);
+	verify.records = calloc(VERIFY_BATCH_FILES, sizeof(*verify.records));
+	if (!verify.buffer || !verify.records) {
+		fprintf(stderr, "Memory for verify batch couldn't be allocated\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	while (!input_eof()) {
+		ret = verify_next();
+		if (ret < 0)
+			goto out;
+		if (ret > 0)
+			break;
+	}
+
+	verify_flush();
+	ret = 0;
+
+	fprintf(stderr, "Verified %"PRIu64" files: %"PRIu64" errors\n",
+		verify.files, verify.errors);
+	if (verify.errors)
+		ret = -EINVAL;
+
+out:
+	free(verify.records);
+	free(verify.buffer);
+
+	return ret;
+}